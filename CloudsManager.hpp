@@ -3,11 +3,15 @@
 
 #include "gl_includes.hpp"
 #include "shader.hpp"
+#include "uniformbuffer.hpp"
 
 #include "imgui.h"
 #include "imgui_impl_glfw.h"
 #include "imgui_impl_opengl3.h"
 
+#include <sstream>
+#include <string>
+
 
 struct VolumeParams {
     int numSteps;
@@ -22,6 +26,17 @@ struct VolumeParams {
 
     float scatteringG;
     glm::vec4 phaseParams;
+
+    bool adaptiveSteps;       // Coarse steps in empty space, growing with the distance and the accumulated opacity
+    float stepDistanceGrowth; // Relative growth of the step size per world unit from the camera
+
+    int scatteringOctaves;    // 1 = single scattering, more approximate multiple scattering
+    float octaveAttenuation;
+    float octaveContribution;
+    float octaveEccentricity;
+
+    bool volumeLod;           // Distance-based mip level of the density samples, cone light marching
+    float coneSpread;         // Growth of the light sample footprint per world unit toward the light
 };
 
 struct GenerationParams {
@@ -30,42 +45,131 @@ struct GenerationParams {
 
     glm::vec3 worldOffset {};
     glm::vec3 worldSize {};
+
+    bool useNoiseTextures = true; // Sample the baked noise textures instead of evaluating simplex noise
+};
+
+struct CloudPassParams {
+    int resolutionDivider = 2; // The clouds are raymarched at 1/resolutionDivider of the G-buffer resolution, 1, 2 or 4
+    int updateInterval = 4;    // 1, 4 or 16: each pixel is raymarched once every updateInterval frames, and reprojected from the previous frame in between
+    bool jitterRays = true;    // Blue-noise offset of the first sample of each ray
+    float historyWeight = 0.8f; // Weight of the history when a pixel is raymarched again, 0 disables the accumulation
+    bool tileBudgets = true;   // Scale the step counts per tile, from the statistics of the previous frame
+    float minBudget = 0.25f;   // Fraction of the step counts left to fully clear or fully opaque tiles
+};
+
+// std140 layout of the VolumeBlock uniform block
+struct VolumeUniforms {
+    int numSteps;
+    int numLightSteps;
+    float stepSize;
+    float lightStepSize;
+
+    float cloudAbsorption;
+    float lightAbsorption;
+    float densityMultiplier;
+    float scatteringG;
+
+    glm::vec4 phaseParams;
+
+    glm::vec3 domainCenter;
+    int adaptiveSteps;
+    glm::vec3 domainSize;
+    float stepDistanceGrowth;
+
+    int scatteringOctaves;
+    float octaveAttenuation;
+    float octaveContribution;
+    float octaveEccentricity;
+
+    int volumeLod;
+    float coneSpread;
+    float pad0;
+    float pad1;
 };
+static_assert(sizeof(VolumeUniforms) == 112, "VolumeUniforms must match the std140 layout of VolumeBlock");
 
 class CloudsManager {
 public:
     VolumeParams m_volumeParams {};
     GenerationParams m_generationParams {};
+    CloudPassParams m_cloudPassParams {};
+
+    UniformBuffer<VolumeUniforms> m_volumeBuffer {};
 
+private:
+    int m_lightStepsBound = 8; // NUM_LIGHT_STEPS of the variants, only updated when the slider is released
 
 public:
     CloudsManager() = default;
     ~CloudsManager() = default;
     
-    void setUniforms(GLuint shader) {
-        setUniform(shader, "MAX_STEPS", m_volumeParams.numSteps);
-        setUniform(shader, "MAX_LIGHT_STEPS", m_volumeParams.numLightSteps);
-        setUniform(shader, "u_stepSize", m_volumeParams.stepSize);
-        setUniform(shader, "u_lightStepSize", m_volumeParams.lightStepSize);
+    void initUniformBuffer() {
+        m_volumeBuffer.init(VOLUME_BLOCK_BINDING);
+    }
+
+    void release() {
+        m_volumeBuffer.release();
+    }
+
+    // Uploads the volume parameters, only if they changed since the last call
+    void updateUniformBuffer() {
+        VolumeUniforms data {};
+
+        data.numSteps = m_volumeParams.numSteps;
+        data.numLightSteps = m_volumeParams.numLightSteps;
+        data.stepSize = m_volumeParams.stepSize;
+        data.lightStepSize = m_volumeParams.lightStepSize;
+
+        data.cloudAbsorption = m_volumeParams.cloudAbsorption;
+        data.lightAbsorption = m_volumeParams.lightAbsorption;
+        data.densityMultiplier = m_volumeParams.densityMultiplier;
+        data.scatteringG = m_volumeParams.scatteringG;
+
+        data.phaseParams = m_volumeParams.phaseParams;
+
+        data.domainCenter = m_generationParams.domainCenter;
+        data.domainSize = m_generationParams.domainSize;
 
-        setUniform(shader, "u_cloudAbsorption", m_volumeParams.cloudAbsorption);
-        setUniform(shader, "u_lightAbsorption", m_volumeParams.lightAbsorption);
-        setUniform(shader, "u_densityMultiplier", m_volumeParams.densityMultiplier);
+        data.adaptiveSteps = m_volumeParams.adaptiveSteps;
+        data.stepDistanceGrowth = m_volumeParams.stepDistanceGrowth;
 
-        setUniform(shader, "u_scatteringG", m_volumeParams.scatteringG);
-        setUniform(shader, "u_phaseParams", m_volumeParams.phaseParams);
+        data.scatteringOctaves = m_volumeParams.scatteringOctaves;
+        data.octaveAttenuation = m_volumeParams.octaveAttenuation;
+        data.octaveContribution = m_volumeParams.octaveContribution;
+        data.octaveEccentricity = m_volumeParams.octaveEccentricity;
 
-        setUniform(shader, "u_domainCenter", m_generationParams.domainCenter);
-        setUniform(shader, "u_domainSize", m_generationParams.domainSize);
+        data.volumeLod = m_volumeParams.volumeLod;
+        data.coneSpread = m_volumeParams.coneSpread;
+
+        m_volumeBuffer.set(data);
+        m_volumeBuffer.upload();
+    }
+
+    // Part of the volume parameters compiled into the variants of the raymarching programs (see cloudCommon.glsl):
+    // the bound of the light march loop, the number of scattering octaves and the feature toggles.
+    // The bound is a power of two, the exact number of light steps stays a uniform the loop breaks on,
+    // so that the light steps slider only ever needs a handful of variants.
+    std::string variantDefines() const {
+        std::ostringstream defines;
+        defines << "#define NUM_LIGHT_STEPS " << m_lightStepsBound << "\n";
+        defines << "#define SCATTERING_OCTAVES " << m_volumeParams.scatteringOctaves << "\n";
+        defines << "#define ADAPTIVE_STEPS " << (m_volumeParams.adaptiveSteps ? "true" : "false") << "\n";
+        defines << "#define VOLUME_LOD " << (m_volumeParams.volumeLod ? "true" : "false") << "\n";
+        return defines.str();
     }
 
     void setDefaults() {
-        m_volumeParams.numSteps = 100;
-        m_volumeParams.numLightSteps = 20;
+        m_volumeParams.numSteps = 12; // Enough with the jittered, accumulated and analytically integrated rays
+        m_volumeParams.numLightSteps = 8;
+        m_lightStepsBound = lightStepsBound(m_volumeParams.numLightSteps);
 
         m_volumeParams.stepSize = 0.01f;
         m_volumeParams.lightStepSize = 0.01f;
 
+        m_volumeParams.adaptiveSteps = true;
+        m_volumeParams.stepDistanceGrowth = 0.002f;
+
         m_generationParams.domainCenter = glm::vec3(0, 30, 0);
         m_generationParams.domainSize = glm::vec3(100, 10, 100);
 
@@ -75,21 +179,49 @@ public:
 
         m_volumeParams.scatteringG = 0.5f;
         m_volumeParams.phaseParams = glm::vec4(0.74f, 0.1f, 0.1f, 1.0f);
-    }
 
-    bool renderUI() {
-        bool changed = false;
+        m_volumeParams.scatteringOctaves = 1;
+        m_volumeParams.octaveAttenuation = 0.5f;
+        m_volumeParams.octaveContribution = 0.5f;
+        m_volumeParams.octaveEccentricity = 0.5f;
 
+        m_volumeParams.volumeLod = true;
+        m_volumeParams.coneSpread = 0.2f;
+    }
+
+    void renderUI() {
         ImGui::Begin("Volume", nullptr, ImGuiWindowFlags_AlwaysAutoResize);
 
         ImGui::SliderInt("Num steps", &m_volumeParams.numSteps, 0, 200);
         ImGui::SliderInt("Num light steps", &m_volumeParams.numLightSteps, 0, 100);
+        if(!ImGui::IsItemActive()) m_lightStepsBound = lightStepsBound(m_volumeParams.numLightSteps); // Not on every step of a drag
 
         ImGui::SliderFloat("Step size", &m_volumeParams.stepSize, 0.01f, 0.5f);
         ImGui::SliderFloat("Light step size", &m_volumeParams.lightStepSize, 0.01f, 0.5f);
-
-        if(ImGui::SliderFloat3("Center", &m_generationParams.domainCenter.x, -10.0f, 10.0f)) changed = true;
-        if(ImGui::SliderFloat3("Size", &m_generationParams.domainSize.x, 0.0f, 10.0f)) changed = true;
+        ImGui::Checkbox("Adaptive steps", &m_volumeParams.adaptiveSteps);
+        ImGui::SliderFloat("Step distance growth", &m_volumeParams.stepDistanceGrowth, 0.0f, 0.02f);
+        ImGui::Checkbox("Volume LOD and cone light march", &m_volumeParams.volumeLod);
+        ImGui::SliderFloat("Cone spread", &m_volumeParams.coneSpread, 0.0f, 1.0f);
+
+        const char* resolutions[] = { "Full", "Half", "Quarter" };
+        int resolution = m_cloudPassParams.resolutionDivider == 4 ? 2 : m_cloudPassParams.resolutionDivider - 1;
+        if(ImGui::Combo("Cloud resolution", &resolution, resolutions, IM_ARRAYSIZE(resolutions))) {
+            m_cloudPassParams.resolutionDivider = 1 << resolution;
+        }
+
+        const char* intervals[] = { "Every frame", "1/4 pixels", "1/16 pixels" };
+        int interval = m_cloudPassParams.updateInterval == 16 ? 2 : m_cloudPassParams.updateInterval / 4;
+        if(ImGui::Combo("Cloud updates", &interval, intervals, IM_ARRAYSIZE(intervals))) {
+            m_cloudPassParams.updateInterval = interval == 0 ? 1 : 1 << (interval * 2);
+        }
+        ImGui::Checkbox("Jitter rays", &m_cloudPassParams.jitterRays);
+        ImGui::SliderFloat("History weight", &m_cloudPassParams.historyWeight, 0.0f, 0.95f);
+        ImGui::Checkbox("Per-tile step budget", &m_cloudPassParams.tileBudgets);
+        ImGui::SliderFloat("Min budget", &m_cloudPassParams.minBudget, 0.05f, 1.0f);
+
+        ImGui::SliderFloat3("Center", &m_generationParams.domainCenter.x, -10.0f, 10.0f);
+        ImGui::SliderFloat3("Size", &m_generationParams.domainSize.x, 0.0f, 10.0f);
+        ImGui::Checkbox("Baked noise textures", &m_generationParams.useNoiseTextures);
 
         ImGui::SliderFloat("Cloud absorption", &m_volumeParams.cloudAbsorption, 0.0f, 2.0f);
         ImGui::SliderFloat("Light absorption", &m_volumeParams.lightAbsorption, 0.0f, 2.0f);
@@ -98,9 +230,22 @@ public:
         ImGui::SliderFloat("Scattering G", &m_volumeParams.scatteringG, -1.0f, 1.0f);
         ImGui::SliderFloat4("Phase params", &m_volumeParams.phaseParams.x, 0.0f, 1.0f);
 
+        ImGui::SliderInt("Scattering octaves", &m_volumeParams.scatteringOctaves, 1, 4);
+        if(m_volumeParams.scatteringOctaves > 1) {
+            ImGui::SliderFloat("Octave attenuation", &m_volumeParams.octaveAttenuation, 0.0f, 1.0f);
+            ImGui::SliderFloat("Octave contribution", &m_volumeParams.octaveContribution, 0.0f, 1.0f);
+            ImGui::SliderFloat("Octave eccentricity", &m_volumeParams.octaveEccentricity, 0.0f, 1.0f);
+        }
+
         ImGui::End();
+    }
 
-        return changed;
+private:
+    // Smallest of 8, 16, 32, 64 and 128 not below numLightSteps
+    static int lightStepsBound(int numLightSteps) {
+        int bound = 8;
+        while(bound < numLightSteps && bound < 128) bound *= 2;
+        return bound;
     }
 };
 
@@ -0,0 +1,210 @@
+#ifndef BENCHMARK_HPP
+#define BENCHMARK_HPP
+
+#include "gl_includes.hpp"
+#include "profiler.hpp"
+#include "volumeformat.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+struct BenchmarkParams {
+    bool enabled = false;
+    bool cpuGenerator = false; // Only measure the throughput of the CPU volume generator
+
+    int numFrames = 600;    // Frames recorded in the results
+    int warmupFrames = 60;  // Frames rendered before recording, to let the driver settle
+    float timeStep = 1.0f / 60.0f; // Fixed simulation time between two frames, in seconds
+    float orbitPeriod = 10.0f;     // Time for the camera to do a full turn around the target, in seconds
+
+    std::string outputPath = "bench.json";
+    int volumeFormat = -1; // VolumeFormat to render with, -1 for the default one
+    float weatherTime = -1.0f; // Fixed generation time of the clouds (not only for the benchmark), negative to animate
+};
+
+struct FrameStats {
+    double min;
+    double max;
+    double mean;
+    double median;
+    double p95;
+    double p99;
+};
+
+// Replays a deterministic camera path with a fixed time step, and records the time taken by each frame.
+// The frame time is measured on the CPU after a glFinish, so it includes all the GPU work of the frame.
+// The BC4 readback and encoding done in a frame is recorded apart, so that it can be subtracted when comparing formats.
+class Benchmark {
+public:
+    BenchmarkParams m_params {};
+    std::vector<double> m_frameTimes {}; // In ms
+    std::vector<double> m_encodeTimes {}; // CPU time of the volume encoding in each frame, in ms
+
+private:
+    std::chrono::steady_clock::time_point m_frameStart {};
+
+public:
+    // Returns false if the command line is invalid
+    bool parseArgs(int argc, char **argv) {
+        for(int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            bool hasValue = i + 1 < argc;
+
+            if(arg == "--bench") {
+                m_params.enabled = true;
+            } else if(arg == "--bench-cpu") {
+                m_params.cpuGenerator = true;
+            } else if(arg == "--bench-frames" && hasValue) {
+                m_params.numFrames = std::max(1, std::atoi(argv[++i]));
+            } else if(arg == "--bench-warmup" && hasValue) {
+                m_params.warmupFrames = std::max(0, std::atoi(argv[++i]));
+            } else if(arg == "--bench-out" && hasValue) {
+                m_params.outputPath = argv[++i];
+            } else if(arg == "--bench-format" && hasValue && volumeFormatFromName(argv[i + 1]) >= 0) {
+                m_params.volumeFormat = volumeFormatFromName(argv[++i]);
+            } else if(arg == "--weather-time" && hasValue) {
+                m_params.weatherTime = std::max(0.0f, static_cast<float>(std::atof(argv[++i])));
+            } else {
+                std::cerr << "ERROR: Unknown argument '" << arg << "'" << std::endl;
+                std::cerr << "Usage: " << argv[0] << " [--bench] [--bench-cpu] [--bench-frames N] [--bench-warmup N] [--bench-out file.json] [--bench-format r32f|r16f|r8|bc4] [--weather-time seconds]" << std::endl;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    int totalFrames() const {
+        return m_params.warmupFrames + m_params.numFrames;
+    }
+
+    float frameTime(int frame) const {
+        return frame * m_params.timeStep;
+    }
+
+    // Camera orbit around the target, looking slightly upwards to the cloud layer
+    void cameraPath(int frame, float &yaw, float &pitch, float &distance) const {
+        float t = frameTime(frame) / m_params.orbitPeriod;
+
+        yaw = 2.0f * static_cast<float>(M_PI) * t;
+        pitch = 0.3f + 0.2f * std::sin(4.0f * static_cast<float>(M_PI) * t);
+        distance = 5.0f + 2.0f * std::cos(2.0f * static_cast<float>(M_PI) * t);
+    }
+
+    void beginFrame() {
+        m_frameStart = std::chrono::steady_clock::now();
+    }
+
+    void endFrame(int frame, double encodeMs) {
+        glFinish();
+        std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - m_frameStart;
+
+        if(frame >= m_params.warmupFrames) {
+            m_frameTimes.push_back(elapsed.count());
+            m_encodeTimes.push_back(encodeMs);
+        }
+    }
+
+    static FrameStats computeStats(const std::vector<double> &times) {
+        FrameStats stats {};
+        if(times.empty()) return stats;
+
+        std::vector<double> sorted = times;
+        std::sort(sorted.begin(), sorted.end());
+
+        double sum = 0.0;
+        for(double t : sorted) sum += t;
+
+        stats.min = sorted.front();
+        stats.max = sorted.back();
+        stats.mean = sum / sorted.size();
+        stats.median = percentile(sorted, 0.5);
+        stats.p95 = percentile(sorted, 0.95);
+        stats.p99 = percentile(sorted, 0.99);
+
+        return stats;
+    }
+
+    bool writeResults(int width, int height, const GpuProfiler &profiler, int volumeFormat, size_t volumeMemory) const {
+        std::vector<double> renderTimes(m_frameTimes.size());
+        for(size_t i = 0; i < m_frameTimes.size(); i++) renderTimes[i] = m_frameTimes[i] - m_encodeTimes[i];
+
+        FrameStats stats = computeStats(m_frameTimes);
+
+        std::ofstream file(m_params.outputPath.c_str());
+        if(!file.good()) {
+            std::cerr << "ERROR: Cannot open file '" << m_params.outputPath << "'" << std::endl;
+            return false;
+        }
+
+        const char *renderer = reinterpret_cast<const char *>(glGetString(GL_RENDERER));
+        const char *version = reinterpret_cast<const char *>(glGetString(GL_VERSION));
+
+        file << "{\n";
+        file << "  \"renderer\": \"" << jsonEscape(renderer ? renderer : "") << "\",\n";
+        file << "  \"version\": \"" << jsonEscape(version ? version : "") << "\",\n";
+        file << "  \"width\": " << width << ",\n";
+        file << "  \"height\": " << height << ",\n";
+        file << "  \"frames\": " << m_frameTimes.size() << ",\n";
+        file << "  \"warmupFrames\": " << m_params.warmupFrames << ",\n";
+        file << "  \"timeStep\": " << m_params.timeStep << ",\n";
+        file << "  \"volumeFormat\": \"" << volumeFormatInfo(volumeFormat).name << "\",\n";
+        file << "  \"volumeMemoryMiB\": " << volumeMemory / (1024.0 * 1024.0) << ",\n";
+        writeStats(file, "frameTimeMs", stats);
+        writeStats(file, "frameTimeExcludingEncodeMs", computeStats(renderTimes));
+        writeStats(file, "volumeEncodeMs", computeStats(m_encodeTimes));
+        file << "  \"gpuStagesMeanMs\": {";
+        for(size_t i = 0; i < profiler.m_stages.size(); i++) {
+            const GpuProfiler::Stage &stage = profiler.m_stages[i];
+            double mean = stage.numSamples > 0 ? stage.totalMs / stage.numSamples : 0.0;
+            file << (i ? ", " : "") << "\"" << jsonEscape(stage.name) << "\": " << mean;
+        }
+        file << "},\n";
+        file << "  \"frameTimesMs\": [";
+        for(size_t i = 0; i < m_frameTimes.size(); i++) {
+            file << (i ? ", " : "") << m_frameTimes[i];
+        }
+        file << "]\n";
+        file << "}\n";
+
+        std::cout << "Benchmark: " << m_frameTimes.size() << " frames, median " << stats.median << " ms, p95 " << stats.p95
+                  << " ms, p99 " << stats.p99 << " ms -> " << m_params.outputPath << std::endl;
+
+        return true;
+    }
+
+private:
+    static void writeStats(std::ofstream &file, const char *name, const FrameStats &stats) {
+        file << "  \"" << name << "\": {\n";
+        file << "    \"min\": " << stats.min << ",\n";
+        file << "    \"max\": " << stats.max << ",\n";
+        file << "    \"mean\": " << stats.mean << ",\n";
+        file << "    \"median\": " << stats.median << ",\n";
+        file << "    \"p95\": " << stats.p95 << ",\n";
+        file << "    \"p99\": " << stats.p99 << "\n";
+        file << "  },\n";
+    }
+
+    // Nearest-rank percentile of an already sorted array
+    static double percentile(const std::vector<double> &sorted, double p) {
+        size_t rank = static_cast<size_t>(std::ceil(p * sorted.size()));
+        if(rank > 0) rank--;
+        return sorted[std::min(rank, sorted.size() - 1)];
+    }
+
+    static std::string jsonEscape(const std::string &str) {
+        std::string escaped {};
+        for(char c : str) {
+            if(c == '"' || c == '\\') escaped += '\\';
+            escaped += c;
+        }
+        return escaped;
+    }
+};
+
+#endif // BENCHMARK_HPP
@@ -0,0 +1,124 @@
+/*
+    bluenoise.cpp
+
+    Void-and-cluster generator of bluenoise.hpp. The energy of each pixel is the sum of a toroidal gaussian over the
+    pixels set to 1, updated incrementally: each insertion or removal costs one pass over the texture.
+*/
+
+#include "bluenoise.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <random>
+
+namespace {
+
+const float SIGMA = 1.5f;
+const float INITIAL_DENSITY = 0.1f; // Fraction of the pixels set in the initial binary pattern
+
+struct EnergyField {
+    int size;
+    std::vector<float> kernel; // Gaussian of the toroidal offset, indexed like the texture
+    std::vector<float> energy;
+    std::vector<char> pattern;
+
+    explicit EnergyField(int size) : size(size), kernel(size * size), energy(size * size, 0.0f), pattern(size * size, 0) {
+        for (int y = 0; y < size; y++) {
+            for (int x = 0; x < size; x++) {
+                int dx = std::min(x, size - x);
+                int dy = std::min(y, size - y);
+                kernel[y * size + x] = std::exp(-(dx * dx + dy * dy) / (2.0f * SIGMA * SIGMA));
+            }
+        }
+    }
+
+    void set(int index, bool value) {
+        pattern[index] = value;
+        float sign = value ? 1.0f : -1.0f;
+
+        int px = index % size;
+        int py = index / size;
+        for (int y = 0; y < size; y++) {
+            const float *row = &kernel[((y - py + size) % size) * size];
+            for (int x = 0; x < size; x++) {
+                energy[y * size + x] += sign * row[(x - px + size) % size];
+            }
+        }
+    }
+
+    // Set pixel with the highest energy
+    int tightestCluster() const {
+        int best = 0;
+        float bestEnergy = -std::numeric_limits<float>::max();
+        for (int i = 0; i < size * size; i++) {
+            if (pattern[i] && energy[i] > bestEnergy) {
+                best = i;
+                bestEnergy = energy[i];
+            }
+        }
+        return best;
+    }
+
+    // Unset pixel with the lowest energy
+    int largestVoid() const {
+        int best = 0;
+        float bestEnergy = std::numeric_limits<float>::max();
+        for (int i = 0; i < size * size; i++) {
+            if (!pattern[i] && energy[i] < bestEnergy) {
+                best = i;
+                bestEnergy = energy[i];
+            }
+        }
+        return best;
+    }
+};
+
+} // namespace
+
+void BlueNoise::generate(int size, std::vector<float> &values) {
+    const int numPixels = size * size;
+    const int numInitial = std::max(1, static_cast<int>(numPixels * INITIAL_DENSITY));
+
+    // Initial binary pattern: random pixels, then moved from the tightest cluster to the largest void until stable
+    EnergyField field(size);
+    std::mt19937 rng(1234);
+    std::uniform_int_distribution<int> pixel(0, numPixels - 1);
+    for (int count = 0; count < numInitial;) {
+        int index = pixel(rng);
+        if (field.pattern[index]) continue;
+        field.set(index, true);
+        count++;
+    }
+
+    for (;;) {
+        int cluster = field.tightestCluster();
+        field.set(cluster, false);
+        int hole = field.largestVoid();
+        field.set(hole, true);
+        if (hole == cluster) break;
+    }
+
+    EnergyField prototype = field;
+    std::vector<int> ranks(numPixels, 0);
+
+    // Phase 1: ranks below numInitial, removing the tightest clusters of the prototype first
+    for (int rank = numInitial - 1; rank >= 0; rank--) {
+        int cluster = field.tightestCluster();
+        field.set(cluster, false);
+        ranks[cluster] = rank;
+    }
+
+    // Phases 2 and 3: the remaining ranks, filling the largest voids of the prototype first
+    field = prototype;
+    for (int rank = numInitial; rank < numPixels; rank++) {
+        int hole = field.largestVoid();
+        field.set(hole, true);
+        ranks[hole] = rank;
+    }
+
+    values.resize(numPixels);
+    for (int i = 0; i < numPixels; i++) {
+        values[i] = (ranks[i] + 0.5f) / numPixels;
+    }
+}
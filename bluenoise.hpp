@@ -0,0 +1,54 @@
+/*
+    bluenoise.hpp
+
+    Tiled blue-noise texture, generated at startup with the void-and-cluster method (Ulichney 1993).
+    Every value of [0, 1) appears once, and neighbouring texels have distant values, so per-pixel offsets read from it
+    turn the banding of a coarse raymarch into high-frequency noise that the temporal accumulation averages out.
+*/
+
+#ifndef BLUE_NOISE_HPP
+#define BLUE_NOISE_HPP
+
+#include "gl_includes.hpp"
+
+#include <vector>
+
+class BlueNoise {
+public:
+    static const int SIZE = 64;
+
+    GLuint m_texture {};
+
+public:
+    BlueNoise() = default;
+
+    ~BlueNoise() {
+        release();
+    }
+
+    void release() {
+        if (m_texture) glDeleteTextures(1, &m_texture);
+        m_texture = 0;
+    }
+
+    void init() {
+        std::vector<float> values;
+        generate(SIZE, values);
+
+        glGenTextures(1, &m_texture);
+        glBindTexture(GL_TEXTURE_2D, m_texture);
+        // 16-bit UNORM keeps the SIZE * SIZE ranks distinct, R16F would round those above 0.5 to steps of 1/2048
+        glTexStorage2D(GL_TEXTURE_2D, 1, GL_R16, SIZE, SIZE);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, SIZE, SIZE, GL_RED, GL_FLOAT, values.data());
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+
+    // Fills values with size * size ranks in [0, 1), tileable, x first
+    static void generate(int size, std::vector<float> &values);
+};
+
+#endif // BLUE_NOISE_HPP
@@ -0,0 +1,126 @@
+#ifndef CLOUD_BUFFER_HPP
+#define CLOUD_BUFFER_HPP
+
+#include "gl_includes.hpp"
+
+#include <iostream>
+
+// Render target of the cloud pass: light energy and transmittance (RGBA16F), and the distance each ray was marched to
+// along with the mean depth of the cloud it crossed (RG32F). The first distance drives the bilateral upsampling of the
+// lighting pass and the disocclusion test of the reprojection, the second one reprojects the clouds.
+class CloudBuffer {
+public:
+    GLuint m_buffer {};
+    GLuint m_color {};
+    GLuint m_distance {};
+
+    int m_width {};
+    int m_height {};
+
+public:
+    CloudBuffer() = default;
+
+    ~CloudBuffer() {
+        release();
+    }
+
+    // (Re)creates the attachments if the size changed
+    void resize(int width, int height) {
+        if (m_buffer && width == m_width && height == m_height) return;
+
+        release();
+        m_width = width;
+        m_height = height;
+
+        glGenFramebuffers(1, &m_buffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, m_buffer);
+
+        m_color = createAttachment(GL_RGBA16F, GL_LINEAR); // Filtered when read back as history
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_color, 0);
+
+        m_distance = createAttachment(GL_RG32F, GL_NEAREST);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, m_distance, 0);
+
+        GLuint attachments[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+        glDrawBuffers(2, attachments);
+
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "Cloud framebuffer not complete!" << std::endl;
+
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    void release() {
+        if (m_buffer) glDeleteFramebuffers(1, &m_buffer);
+        if (m_color) glDeleteTextures(1, &m_color);
+        if (m_distance) glDeleteTextures(1, &m_distance);
+        m_buffer = m_color = m_distance = 0;
+    }
+
+private:
+    GLuint createAttachment(GLenum internalFormat, GLint filter) const {
+        GLuint texture {};
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexStorage2D(GL_TEXTURE_2D, 1, internalFormat, m_width, m_height);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        return texture;
+    }
+};
+
+// Two cloud buffers used in turn: each frame, the cloud pass writes one of them and reprojects the other, written the
+// frame before. Only one pixel of every block of updateInterval pixels is raymarched each frame, in the order of a
+// Bayer matrix, so that every pixel is refreshed once every updateInterval frames.
+class CloudHistory {
+public:
+    CloudBuffer m_buffers[2];
+    int m_current = 0;
+    int m_frame = 0;
+    bool m_valid = false; // The history buffer holds the previous frame, at the same resolution
+
+    glm::mat4 m_prevProjViewMat {};
+    glm::vec3 m_prevCameraPosition {};
+
+public:
+    // Swaps the buffers, the one written last frame becomes the history
+    void beginFrame(int width, int height) {
+        m_current ^= 1;
+
+        if (width != m_buffers[0].m_width || height != m_buffers[0].m_height) m_valid = false;
+        m_buffers[0].resize(width, height);
+        m_buffers[1].resize(width, height);
+    }
+
+    // Remembers the camera the current buffer was rendered with, to reproject it next frame
+    void endFrame(const glm::mat4 &projViewMat, const glm::vec3 &cameraPosition) {
+        m_prevProjViewMat = projViewMat;
+        m_prevCameraPosition = cameraPosition;
+        m_valid = true;
+        m_frame++;
+    }
+
+    void invalidate() {
+        m_valid = false;
+    }
+
+    void release() {
+        m_buffers[0].release();
+        m_buffers[1].release();
+        m_valid = false;
+    }
+
+    CloudBuffer &current() { return m_buffers[m_current]; }
+    CloudBuffer &history() { return m_buffers[m_current ^ 1]; }
+
+    // Pixel of each block raymarched this frame
+    int updateIndex(int updateInterval) const {
+        return m_frame % updateInterval;
+    }
+};
+
+#endif // CLOUD_BUFFER_HPP
@@ -0,0 +1,180 @@
+/*
+    cpugenerator.cpp
+
+    Scalar and SSE kernels of the CPU density generator, runtime selection and threading.
+    The AVX2 kernel lives in cpugenerator_avx2.cpp, the only file built with AVX2 enabled.
+*/
+
+#include "cpugenerator.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <thread>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CPU_GENERATOR_SSE
+#include <emmintrin.h>
+#ifdef __SSE4_1__
+#include <smmintrin.h>
+#endif
+#endif
+
+namespace {
+
+namespace scalar {
+    const int WIDTH = 1;
+
+    struct F {
+        float v;
+    };
+
+    inline F set1(float x) { F r = { x }; return r; }
+    inline F load(const float *p) { return set1(*p); }
+    inline void store(float *p, F a) { *p = a.v; }
+    inline F operator+(F a, F b) { return set1(a.v + b.v); }
+    inline F operator-(F a, F b) { return set1(a.v - b.v); }
+    inline F operator*(F a, F b) { return set1(a.v * b.v); }
+    inline F operator/(F a, F b) { return set1(a.v / b.v); }
+    inline F floor(F a) { return set1(std::floor(a.v)); }
+    inline F min(F a, F b) { return set1(std::min(a.v, b.v)); }
+    inline F max(F a, F b) { return set1(std::max(a.v, b.v)); }
+    inline F abs(F a) { return set1(std::fabs(a.v)); }
+    inline F ge(F a, F b) { return set1(a.v >= b.v ? 1.0f : 0.0f); }
+    inline bool anyPositive(F a) { return a.v > 0.0f; }
+
+#include "cpugenerator_kernel.inl"
+}
+
+#ifdef CPU_GENERATOR_SSE
+namespace sse {
+    const int WIDTH = 4;
+
+    struct F {
+        __m128 v;
+    };
+
+    inline F wrap(__m128 v) { F r = { v }; return r; }
+    inline F set1(float x) { return wrap(_mm_set1_ps(x)); }
+    inline F load(const float *p) { return wrap(_mm_loadu_ps(p)); }
+    inline void store(float *p, F a) { _mm_storeu_ps(p, a.v); }
+    inline F operator+(F a, F b) { return wrap(_mm_add_ps(a.v, b.v)); }
+    inline F operator-(F a, F b) { return wrap(_mm_sub_ps(a.v, b.v)); }
+    inline F operator*(F a, F b) { return wrap(_mm_mul_ps(a.v, b.v)); }
+    inline F operator/(F a, F b) { return wrap(_mm_div_ps(a.v, b.v)); }
+    inline F floor(F a) {
+#ifdef __SSE4_1__
+        return wrap(_mm_floor_ps(a.v));
+#else
+        // Truncation, minus one where it rounded up (negative non-integers)
+        __m128 truncated = _mm_cvtepi32_ps(_mm_cvttps_epi32(a.v));
+        return wrap(_mm_sub_ps(truncated, _mm_and_ps(_mm_cmpgt_ps(truncated, a.v), _mm_set1_ps(1.0f))));
+#endif
+    }
+    inline F min(F a, F b) { return wrap(_mm_min_ps(a.v, b.v)); }
+    inline F max(F a, F b) { return wrap(_mm_max_ps(a.v, b.v)); }
+    inline F abs(F a) { return wrap(_mm_andnot_ps(_mm_set1_ps(-0.0f), a.v)); }
+    inline F ge(F a, F b) { return wrap(_mm_and_ps(_mm_cmpge_ps(a.v, b.v), _mm_set1_ps(1.0f))); }
+    inline bool anyPositive(F a) { return _mm_movemask_ps(_mm_cmpgt_ps(a.v, _mm_setzero_ps())) != 0; }
+
+#include "cpugenerator_kernel.inl"
+}
+#endif
+
+} // namespace
+
+void densitySliceScalar(const CpuGeneratorParams &params, int z, float *slice) {
+    scalar::densitySlice(params, z, slice);
+}
+
+void densitySliceSse(const CpuGeneratorParams &params, int z, float *slice) {
+#ifdef CPU_GENERATOR_SSE
+    sse::densitySlice(params, z, slice);
+#else
+    scalar::densitySlice(params, z, slice);
+#endif
+}
+
+bool cpuGeneratorHasSse() {
+#ifdef CPU_GENERATOR_SSE
+    return true;
+#else
+    return false;
+#endif
+}
+
+DensitySliceKernel CpuGenerator::selectKernel() {
+    if (cpuGeneratorHasAvx2()) return densitySliceAvx2;
+    if (cpuGeneratorHasSse()) return densitySliceSse;
+    return densitySliceScalar;
+}
+
+std::string CpuGenerator::instructionSet() {
+    if (cpuGeneratorHasAvx2()) return "AVX2";
+    if (cpuGeneratorHasSse()) return "SSE";
+    return "Scalar";
+}
+
+void CpuGenerator::generate(const CpuGeneratorParams &params, std::vector<float> &density, int numThreads) {
+    size_t sliceSize = static_cast<size_t>(params.dimX) * params.dimY;
+    density.resize(sliceSize * params.dimZ);
+
+    if (numThreads <= 0) numThreads = std::max(1u, std::thread::hardware_concurrency());
+    numThreads = std::min(numThreads, params.dimZ);
+
+    DensitySliceKernel kernel = selectKernel();
+
+    // Slices are handed out one at a time, so threads finishing early take over the remaining ones
+    std::atomic<int> nextSlice(0);
+    auto worker = [&]() {
+        for (int z = nextSlice++; z < params.dimZ; z = nextSlice++) {
+            kernel(params, z, density.data() + sliceSize * z);
+        }
+    };
+
+    std::vector<std::thread> threads {};
+    for (int i = 1; i < numThreads; i++) threads.emplace_back(worker);
+    worker();
+    for (std::thread &thread : threads) thread.join();
+}
+
+void CpuGenerator::benchmark(const CpuGeneratorParams &params, int iterations) {
+    std::vector<float> density {};
+    double numVoxels = static_cast<double>(params.dimX) * params.dimY * params.dimZ;
+    int numCores = std::max(1u, std::thread::hardware_concurrency());
+
+    std::cout << "CPU generator: " << params.dimX << " x " << params.dimY << " x " << params.dimZ
+              << " voxels, " << instructionSet() << ", " << numCores << " hardware threads" << std::endl;
+
+    std::vector<int> threadCounts = { 1 };
+    if (numCores > 1) threadCounts.push_back(numCores);
+
+    for (int threads : threadCounts) {
+        generate(params, density, threads); // Warmup
+
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; i++) generate(params, density, threads);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        double voxelsPerSec = numVoxels * iterations / elapsed.count();
+        std::cout << "  " << threads << " thread(s): " << elapsed.count() * 1000.0 / iterations << " ms per volume, "
+                  << voxelsPerSec / 1e6 << " Mvoxels/s, " << voxelsPerSec / threads / 1e6 << " Mvoxels/s per core" << std::endl;
+    }
+}
+
+void CpuGenerator::compare(const std::vector<float> &a, const std::vector<float> &b, float &maxError, float &meanError) {
+    maxError = 0.0f;
+    meanError = 0.0f;
+    size_t count = std::min(a.size(), b.size());
+    if (count == 0) return;
+
+    double sum = 0.0;
+    for (size_t i = 0; i < count; i++) {
+        float error = std::fabs(a[i] - b[i]);
+        maxError = std::max(maxError, error);
+        sum += error;
+    }
+    meanError = static_cast<float>(sum / count);
+}
@@ -0,0 +1,55 @@
+/*
+    cpugenerator.hpp
+
+    CPU port of the simplex density function of compute.glsl, vectorized (AVX2, SSE or scalar, selected at runtime)
+    and parallelized across Z-slices. Used as an offline baker, as a reference to validate the GPU output,
+    and as a fallback on machines without compute shaders.
+*/
+
+#ifndef CPU_GENERATOR_HPP
+#define CPU_GENERATOR_HPP
+
+#include <string>
+#include <vector>
+
+// Everything the density function needs, in plain floats so the kernels do not depend on glm
+struct CpuGeneratorParams {
+    int dimX;
+    int dimY;
+    int dimZ;
+
+    float targetSize[3];   // Half-size of the domain
+    float targetOffset[3]; // Center of the domain
+    float time;
+};
+
+// Generates the rows (all x, for the given y and z) of a single Z-slice. Implemented once per instruction set.
+typedef void (*DensitySliceKernel)(const CpuGeneratorParams &params, int z, float *slice);
+
+class CpuGenerator {
+public:
+    // Fills density with dimX * dimY * dimZ values, x first, then y, then z, as expected by glTexSubImage3D.
+    // numThreads = 0 uses all the hardware threads.
+    static void generate(const CpuGeneratorParams &params, std::vector<float> &density, int numThreads = 0);
+
+    // Name of the instruction set used by generate()
+    static std::string instructionSet();
+
+    // Prints the throughput in voxels/sec, single-threaded and multi-threaded
+    static void benchmark(const CpuGeneratorParams &params, int iterations = 5);
+
+    // Largest and mean absolute difference between two volumes
+    static void compare(const std::vector<float> &a, const std::vector<float> &b, float &maxError, float &meanError);
+
+private:
+    static DensitySliceKernel selectKernel();
+};
+
+// Kernels of the instruction-set specific translation units
+void densitySliceScalar(const CpuGeneratorParams &params, int z, float *slice);
+void densitySliceSse(const CpuGeneratorParams &params, int z, float *slice);
+void densitySliceAvx2(const CpuGeneratorParams &params, int z, float *slice);
+bool cpuGeneratorHasSse();
+bool cpuGeneratorHasAvx2(); // Compiled in and supported by the CPU
+
+#endif // CPU_GENERATOR_HPP
@@ -0,0 +1,75 @@
+/*
+    cpugenerator_avx2.cpp
+
+    AVX2 kernel of the CPU density generator. This file is built with AVX2 enabled (see CMakeLists.txt),
+    and the kernel is only called after checking that the CPU supports it.
+*/
+
+#include "cpugenerator.hpp"
+
+#include <cmath>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace {
+
+namespace avx2 {
+    const int WIDTH = 8;
+
+    struct F {
+        __m256 v;
+    };
+
+    inline F wrap(__m256 v) { F r = { v }; return r; }
+    inline F set1(float x) { return wrap(_mm256_set1_ps(x)); }
+    inline F load(const float *p) { return wrap(_mm256_loadu_ps(p)); }
+    inline void store(float *p, F a) { _mm256_storeu_ps(p, a.v); }
+    inline F operator+(F a, F b) { return wrap(_mm256_add_ps(a.v, b.v)); }
+    inline F operator-(F a, F b) { return wrap(_mm256_sub_ps(a.v, b.v)); }
+    inline F operator*(F a, F b) { return wrap(_mm256_mul_ps(a.v, b.v)); }
+    inline F operator/(F a, F b) { return wrap(_mm256_div_ps(a.v, b.v)); }
+    inline F floor(F a) { return wrap(_mm256_floor_ps(a.v)); }
+    inline F min(F a, F b) { return wrap(_mm256_min_ps(a.v, b.v)); }
+    inline F max(F a, F b) { return wrap(_mm256_max_ps(a.v, b.v)); }
+    inline F abs(F a) { return wrap(_mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v)); }
+    inline F ge(F a, F b) { return wrap(_mm256_and_ps(_mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ), _mm256_set1_ps(1.0f))); }
+    inline bool anyPositive(F a) { return _mm256_movemask_ps(_mm256_cmp_ps(a.v, _mm256_setzero_ps(), _CMP_GT_OQ)) != 0; }
+
+#include "cpugenerator_kernel.inl"
+}
+
+} // namespace
+
+void densitySliceAvx2(const CpuGeneratorParams &params, int z, float *slice) {
+    avx2::densitySlice(params, z, slice);
+}
+
+bool cpuGeneratorHasAvx2() {
+#if defined(__GNUC__)
+    return __builtin_cpu_supports("avx2");
+#elif defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return false;
+#endif
+}
+
+#else // Not an x86 build, or AVX2 disabled
+
+void densitySliceAvx2(const CpuGeneratorParams &params, int z, float *slice) {
+    densitySliceSse(params, z, slice);
+}
+
+bool cpuGeneratorHasAvx2() {
+    return false;
+}
+
+#endif
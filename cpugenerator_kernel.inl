@@ -0,0 +1,165 @@
+/*
+    cpugenerator_kernel.inl
+
+    Density kernel shared by the instruction-set specific translation units.
+    Before including it, the translation unit defines, in the same namespace, a vector type F of WIDTH floats and:
+    set1, load, store, +, -, *, /, floor, min, max, abs, ge (1.0 where a >= b, else 0.0) and anyPositive.
+    The code mirrors snoise(), fbm() and main() of compute.glsl, line by line.
+*/
+
+struct V3 {
+    F x, y, z;
+};
+
+inline V3 v3(F x, F y, F z) {
+    V3 v = { x, y, z };
+    return v;
+}
+
+inline F dot3(const V3 &a, const V3 &b) {
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+inline F mod289(F x) {
+    const F m = set1(289.0f);
+    return x - m * floor(x / m);
+}
+
+inline F permute(F x) {
+    return mod289((x * set1(34.0f) + set1(1.0f)) * x);
+}
+
+inline F snoise(const V3 &v) {
+    const float Cx = 1.0f / 6.0f;
+    const float Cy = 1.0f / 3.0f;
+
+    // First corner
+    F s = (v.x + v.y + v.z) * set1(Cy);
+    V3 i = v3(floor(v.x + s), floor(v.y + s), floor(v.z + s));
+    F t = (i.x + i.y + i.z) * set1(Cx);
+    V3 x0 = v3(v.x - i.x + t, v.y - i.y + t, v.z - i.z + t);
+
+    // Other corners
+    const F one = set1(1.0f);
+    F gx = ge(x0.x, x0.y), gy = ge(x0.y, x0.z), gz = ge(x0.z, x0.x);
+    F lx = one - gx, ly = one - gy, lz = one - gz;
+    V3 i1 = v3(min(gx, lz), min(gy, lx), min(gz, ly));
+    V3 i2 = v3(max(gx, lz), max(gy, lx), max(gz, ly));
+
+    V3 corners[4];
+    corners[0] = x0;
+    corners[1] = v3(x0.x - i1.x + set1(Cx), x0.y - i1.y + set1(Cx), x0.z - i1.z + set1(Cx));
+    corners[2] = v3(x0.x - i2.x + set1(2.0f * Cx), x0.y - i2.y + set1(2.0f * Cx), x0.z - i2.z + set1(2.0f * Cx));
+    corners[3] = v3(x0.x - one + set1(3.0f * Cx), x0.y - one + set1(3.0f * Cx), x0.z - one + set1(3.0f * Cx));
+
+    const F zero = set1(0.0f);
+    V3 offsets[4] = { v3(zero, zero, zero), i1, i2, v3(one, one, one) };
+
+    // Permutations
+    i = v3(mod289(i.x), mod289(i.y), mod289(i.z));
+
+    const float n_ = 1.0f / 7.0f; // N=7
+    const float nsx = n_ * 2.0f;
+    const float nsy = n_ * 0.5f - 1.0f;
+    const float nsz = n_;
+
+    F sum = zero;
+    for (int k = 0; k < 4; k++) {
+        F p = permute(permute(permute(i.z + offsets[k].z) + i.y + offsets[k].y) + i.x + offsets[k].x);
+
+        // Gradients
+        F j = p - set1(49.0f) * floor(p * set1(nsz) * set1(nsz));
+        F x_ = floor(j * set1(nsz));
+        F y_ = floor(j - set1(7.0f) * x_);
+
+        F gradX = x_ * set1(nsx) + set1(nsy);
+        F gradY = y_ * set1(nsx) + set1(nsy);
+        F h = one - abs(gradX) - abs(gradY);
+
+        F sh = zero - ge(zero, h); // -step(h, 0)
+        gradX = gradX + (floor(gradX) * set1(2.0f) + one) * sh;
+        gradY = gradY + (floor(gradY) * set1(2.0f) + one) * sh;
+
+        V3 gradient = v3(gradX, gradY, h);
+
+        // Normalise gradients
+        F norm = set1(1.79284291400159f) - set1(0.85373472095314f) * dot3(gradient, gradient);
+        gradient = v3(gradient.x * norm, gradient.y * norm, gradient.z * norm);
+
+        // Mix final noise value
+        F m = max(set1(0.6f) - dot3(corners[k], corners[k]), zero);
+        m = m * m;
+        sum = sum + m * m * dot3(gradient, corners[k]);
+    }
+
+    return set1(42.0f) * sum;
+}
+
+inline F fbm(const V3 &pos, int octaves) {
+    F noiseSum = set1(0.0f);
+    float frequency = 1.0f, amplitude = 1.0f;
+
+    for (int i = 0; i < octaves; ++i) {
+        V3 p = v3(pos.x * set1(frequency) + set1(i * 100.02341f),
+                  pos.y * set1(frequency) + set1(121.0f + i * 200.0354310f),
+                  pos.z * set1(frequency) + set1(121.0f + i * 150.02451f));
+        noiseSum = noiseSum + snoise(p) * set1(amplitude);
+        amplitude *= 0.7f;
+        frequency *= 2.58f;
+    }
+
+    return noiseSum;
+}
+
+inline void densitySlice(const CpuGeneratorParams &params, int z, float *slice) {
+    const float windSpeed = 10.0f; // windDir = (0, 0, 1)
+
+    float offsetZ = (static_cast<float>(z) / params.dimZ * 2.0f - 1.0f) * params.targetSize[2] + params.targetOffset[2];
+    float coverageZ = offsetZ + windSpeed * params.time;
+    float detailsZ = offsetZ + windSpeed * params.time * 1.5f;
+
+    float laneIndices[WIDTH];
+    for (int lane = 0; lane < WIDTH; lane++) laneIndices[lane] = static_cast<float>(lane);
+    const F lanes = load(laneIndices);
+
+    for (int y = 0; y < params.dimY; y++) {
+        float normalizedHeight = (static_cast<float>(y) / params.dimY) * 2.0f - 1.0f;
+        float heightFactor = 1.0f - std::fabs(normalizedHeight);
+        float posY = (static_cast<float>(y) / params.dimY * 2.0f - 1.0f) * params.targetSize[1] + params.targetOffset[1];
+
+        float *row = slice + y * params.dimX;
+
+        for (int x = 0; x < params.dimX; x += WIDTH) {
+            F coordX = set1(static_cast<float>(x)) + lanes;
+            F posX = (coordX / set1(static_cast<float>(params.dimX)) * set1(2.0f) - set1(1.0f)) * set1(params.targetSize[0]) + set1(params.targetOffset[0]);
+
+            // coverageSizing = (0.01, 0.0, 0.01)
+            V3 coveragePos = v3(posX * set1(0.01f), set1(posY * 0.0f), set1(coverageZ * 0.01f));
+            F cloudCoverage = fbm(coveragePos, 2) * set1(0.5f) + set1(0.2f);
+            cloudCoverage = max(cloudCoverage, set1(0.0f));
+
+            cloudCoverage = cloudCoverage * set1(heightFactor);
+
+            if (anyPositive(cloudCoverage)) {
+                // detailsSizing = (0.1, 0.2, 0.1) * 0.5
+                V3 detailsPos = v3(posX * set1(0.05f), set1(posY * 0.1f), set1(detailsZ * 0.05f));
+                F details = (fbm(detailsPos, 4) * set1(0.5f) + set1(0.5f)) * set1(0.8f);
+                F eroded = cloudCoverage - details * set1(0.4f);
+
+                // Only where cloudCoverage > 0, like the branch of the shader
+                F mask = ge(set1(0.0f), cloudCoverage); // 1 where there is no coverage
+                cloudCoverage = mask * cloudCoverage + (set1(1.0f) - mask) * eroded;
+            }
+
+            cloudCoverage = min(max(cloudCoverage, set1(0.0f)), set1(1.0f));
+
+            if (x + WIDTH <= params.dimX) {
+                store(row + x, cloudCoverage);
+            } else {
+                float tail[WIDTH];
+                store(tail, cloudCoverage);
+                for (int lane = 0; x + lane < params.dimX; lane++) row[x + lane] = tail[lane];
+            }
+        }
+    }
+}
@@ -13,10 +13,12 @@
 #include "gl_includes.hpp"
 #include "mesh.hpp"
 
+// G-buffer of the deferred pipeline: 4 + 4 + 4 bytes per pixel.
+// The lighting passes reconstruct the position from the depth, and decode the octahedral normals.
 class FrameBuffer {
 public:
     GLuint m_Buffer {};
-    GLuint m_position {};
+    GLuint m_depth {};
     GLuint m_normal {};
     GLuint m_albedo {};
 
@@ -36,40 +38,35 @@ public:
         glGenFramebuffers(1, &m_Buffer);
         glBindFramebuffer(GL_FRAMEBUFFER, m_Buffer);
 
-        // - Position color buffer
-        glGenTextures(1, &m_position);
-        glBindTexture(GL_TEXTURE_2D, m_position);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, m_Width, m_Height, 0, GL_RGB, GL_FLOAT, nullptr);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_position, 0);
-
-        // - Normal color buffer
+        // - Normal color buffer, octahedral encoding
         glGenTextures(1, &m_normal);
         glBindTexture(GL_TEXTURE_2D, m_normal);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, m_Width, m_Height, 0, GL_RGB, GL_FLOAT, nullptr);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16, m_Width, m_Height, 0, GL_RG, GL_UNSIGNED_SHORT, nullptr);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, m_normal, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_normal, 0);
 
-        // - Color + Specular color buffer
+        // - Color buffer
         glGenTextures(1, &m_albedo);
         glBindTexture(GL_TEXTURE_2D, m_albedo);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, m_Width, m_Height, 0, GL_RGB, GL_FLOAT, nullptr);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, m_Width, m_Height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, m_albedo, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, m_albedo, 0);
 
         // - Tell OpenGL which color attachments we'll use (of this framebuffer) for rendering 
-        GLuint attachments[3] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2 };
-        glDrawBuffers(3, attachments);
+        GLuint attachments[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+        glDrawBuffers(2, attachments);
 
-        // - Create and attach depth buffer (renderbuffer)
-        GLuint rboDepth;
-        glGenRenderbuffers(1, &rboDepth);
-        glBindRenderbuffer(GL_RENDERBUFFER, rboDepth);
-        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, m_Width, m_Height);
-        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, rboDepth);
+        // - Depth buffer, sampled by the lighting passes to reconstruct the positions
+        glGenTextures(1, &m_depth);
+        glBindTexture(GL_TEXTURE_2D, m_depth);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32F, m_Width, m_Height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, m_depth, 0);
 
         // - Finally check if framebuffer is complete
         if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
@@ -80,12 +77,27 @@ public:
         m_quad = Mesh::genPlane();
     }
 
-    ~FrameBuffer() {
+    // Reallocates the attachments if the size changed
+    void resize(int width, int height) {
+        if (width == m_Width && height == m_Height) return;
+
+        releaseFramebuffer();
+        m_Width = width;
+        m_Height = height;
+        initFramebuffer();
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    void releaseFramebuffer() {
         glDeleteFramebuffers(1, &m_Buffer);
-        glDeleteTextures(1, &m_position);
+        glDeleteTextures(1, &m_depth);
         glDeleteTextures(1, &m_normal);
         glDeleteTextures(1, &m_albedo);
     }
+
+    ~FrameBuffer() {
+        releaseFramebuffer();
+    }
 };
 
 
@@ -0,0 +1,18 @@
+#ifndef HASH_HPP
+#define HASH_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+// FNV-1a, chained through seed. Used for the keys of the on-disk caches, so it must stay the same between runs.
+inline uint64_t hashBytes(const void *data, size_t size, uint64_t seed = 14695981039346656037ull) {
+    const unsigned char *bytes = static_cast<const unsigned char *>(data);
+    uint64_t hash = seed;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+#endif // HASH_HPP
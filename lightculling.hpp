@@ -0,0 +1,147 @@
+#ifndef LIGHT_CULLING_HPP
+#define LIGHT_CULLING_HPP
+
+#include "gl_includes.hpp"
+#include "shader.hpp"
+#include "shadermanager.hpp"
+#include "uniformbuffer.hpp"
+
+// Tiled light culling of the deferred passes. lightCulling.glsl bins the lights into TILE_SIZE^2 tiles of the G-buffer,
+// in a shader storage buffer read by the cloud and lighting passes: each pixel only iterates the lights of its tile.
+// Point lights are culled by their radius, ambient and directional lights are in every tile.
+// A tile holds at most MAX_LIGHTS_PER_TILE lights: the point lights of highest index are dropped first, and the number
+// of tiles over the limit is read back, a few frames late, for the UI.
+class LightCulling {
+public:
+    static const int TILE_SIZE = 16;            // Must match LIGHT_TILE_SIZE in lightCulling.glsl
+    static const int MAX_LIGHTS_PER_TILE = 64;  // Must match MAX_LIGHTS_PER_TILE in sceneBlocks.glsl
+    static const int NUM_STATS_BUFFERS = 3;     // Statistics of the frames in flight
+
+    GLuint m_program {};
+    GLuint m_buffer {};
+    int m_tilesX {};
+    int m_tilesY {};
+    int m_width {};
+    int m_height {};
+
+    GLuint m_overflowTiles = 0; // Tiles over MAX_LIGHTS_PER_TILE in the last statistics read back
+    GLuint m_maxTileLights = 0; // Lights of the most crowded tile, dropped ones included
+
+private:
+    GLuint m_statsBuffers[NUM_STATS_BUFFERS] {};
+    GLsync m_statsFences[NUM_STATS_BUFFERS] {};
+    int m_frame = 0;
+
+public:
+    LightCulling() = default;
+
+    ~LightCulling() {
+        release();
+    }
+
+    void release() {
+        ShaderManager::instance().destroy(m_program);
+        if (m_buffer) glDeleteBuffers(1, &m_buffer);
+        m_program = m_buffer = 0;
+
+        for (int i = 0; i < NUM_STATS_BUFFERS; i++) {
+            if (m_statsFences[i]) glDeleteSync(m_statsFences[i]);
+            if (m_statsBuffers[i]) glDeleteBuffers(1, &m_statsBuffers[i]);
+            m_statsFences[i] = 0;
+            m_statsBuffers[i] = 0;
+        }
+    }
+
+    void init() {
+        m_program = ShaderManager::instance().createCompute("../resources/lightCulling.glsl", [](GLuint program) {
+            bindUniformBlock(program, "CameraBlock", CAMERA_BLOCK_BINDING);
+            bindUniformBlock(program, "LightsBlock", LIGHTS_BLOCK_BINDING);
+
+            glUseProgram(program);
+            setUniform(program, "u_Depth", 0);
+            glUseProgram(0);
+        });
+
+        glGenBuffers(1, &m_buffer);
+
+        glGenBuffers(NUM_STATS_BUFFERS, m_statsBuffers);
+        for (int i = 0; i < NUM_STATS_BUFFERS; i++) {
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_statsBuffers[i]);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, 2 * sizeof(GLuint), nullptr, GL_DYNAMIC_READ);
+        }
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+
+    // Bins the lights into the tiles of a G-buffer of the given size
+    void cull(GLuint depthTexture, int width, int height) {
+        resize(width, height);
+
+        // The statistics buffer of this frame was last written NUM_STATS_BUFFERS frames ago
+        int statsIndex = m_frame++ % NUM_STATS_BUFFERS;
+        GLuint statsBuffer = m_statsBuffers[statsIndex];
+        readStats(statsIndex);
+
+        const GLuint zeros[2] = { 0, 0 };
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, statsBuffer);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(zeros), zeros);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+        glUseProgram(m_program);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, depthTexture);
+        setUniform(m_program, "u_lightTileCount", glm::ivec2(m_tilesX, m_tilesY));
+
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, TILE_LIGHTS_BUFFER_BINDING, m_buffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CULLING_STATS_BUFFER_BINDING, statsBuffer);
+        glDispatchCompute(m_tilesX, m_tilesY, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CULLING_STATS_BUFFER_BINDING, 0);
+
+        m_statsFences[statsIndex] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glUseProgram(0);
+    }
+
+    // Tile grid of the last cull(), for a program reading the tiles
+    void setUniforms(GLuint program) const {
+        setUniform(program, "u_lightTileCount", glm::ivec2(m_tilesX, m_tilesY));
+        setUniform(program, "u_lightTileScale", glm::vec2(m_width, m_height) / static_cast<float>(TILE_SIZE));
+    }
+
+private:
+    // Non-blocking: the previous values are kept if the GPU did not reach the fence yet
+    void readStats(int index) {
+        GLsync &fence = m_statsFences[index];
+        if (!fence) return;
+
+        GLenum status = glClientWaitSync(fence, 0, 0);
+        if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED) {
+            GLuint stats[2] = { 0, 0 };
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_statsBuffers[index]);
+            glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(stats), stats);
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+            m_overflowTiles = stats[0];
+            m_maxTileLights = stats[1];
+        }
+        glDeleteSync(fence);
+        fence = 0;
+    }
+
+    void resize(int width, int height) {
+        if (width == m_width && height == m_height) return;
+
+        m_width = width;
+        m_height = height;
+        m_tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+        m_tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+
+        // Per tile: the number of lights, then their indices
+        size_t size = static_cast<size_t>(m_tilesX) * m_tilesY * (MAX_LIGHTS_PER_TILE + 1) * sizeof(GLuint);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, m_buffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, size, nullptr, GL_DYNAMIC_COPY);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    }
+};
+
+#endif // LIGHT_CULLING_HPP
@@ -0,0 +1,124 @@
+#ifndef LIGHT_TRANSMITTANCE_HPP
+#define LIGHT_TRANSMITTANCE_HPP
+
+#include "gl_includes.hpp"
+#include "shader.hpp"
+#include "shadermanager.hpp"
+
+// Optical depth from every point of a density volume toward up to MAX_LIGHTS directional lights, one per channel
+// of a RGBA16F 3D texture, baked by transmittance.glsl. The raymarcher then does a single fetch per sample and light
+// instead of a light march. The depth is integrated from the raw density: the density multiplier and the absorption
+// are applied at lookup, so changing them does not need a new bake.
+// The same lights are also baked into a top-down 2D shadow map (cloudShadow.glsl): the optical depth through the whole
+// volume from each point of the bottom plane of the domain, for the opaque surfaces below the clouds.
+class LightTransmittance {
+public:
+    static const int MAX_LIGHTS = 4;
+    static const int DOWNSCALE = 2; // Resolution of the transmittance volume relative to the density volume
+
+    GLuint m_program {};
+    GLuint m_shadowProgram {};
+
+public:
+    LightTransmittance() = default;
+
+    ~LightTransmittance() {
+        release();
+    }
+
+    void release() {
+        ShaderManager::instance().destroy(m_program);
+        ShaderManager::instance().destroy(m_shadowProgram);
+        m_program = m_shadowProgram = 0;
+    }
+
+    void init() {
+        m_program = createProgram("../resources/transmittance.glsl");
+        m_shadowProgram = createProgram("../resources/cloudShadow.glsl");
+    }
+
+    // Transmittance texture for a density volume of the given size
+    static GLuint create(int dimX, int dimY, int dimZ) {
+        GLuint texture {};
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_3D, texture);
+        glTexStorage3D(GL_TEXTURE_3D, 1, GL_RGBA16F, texels(dimX), texels(dimY), texels(dimZ));
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        glBindTexture(GL_TEXTURE_3D, 0);
+
+        return texture;
+    }
+
+    // Shadow map for a density volume of the given size, one texel per column of voxels
+    static GLuint createShadowMap(int dimX, int dimZ) {
+        GLuint texture {};
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA16F, dimX, dimZ);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        // No optical depth outside of the footprint of the domain
+        const float border[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+        glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, border);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        return texture;
+    }
+
+    // Bakes the optical depth of volume toward the given light directions into target, and into shadowMap.
+    // domainSize is the half-size of the domain, the integration step is the smallest voxel size.
+    void bake(GLuint volume, GLuint target, GLuint shadowMap, int dimX, int dimY, int dimZ, const glm::vec3 &domainSize,
+              const glm::vec3 *directions, int numLights) const {
+        glm::vec3 voxelSize = 2.0f * domainSize / glm::vec3(dimX, dimY, dimZ);
+        float stepSize = glm::min(voxelSize.x, glm::min(voxelSize.y, voxelSize.z));
+
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_3D, volume);
+
+        glUseProgram(m_program);
+        setBakeUniforms(m_program, domainSize, stepSize, directions, numLights);
+        glBindImageTexture(0, target, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+        glDispatchCompute((texels(dimX) + 3) / 4, (texels(dimY) + 3) / 4, (texels(dimZ) + 3) / 4);
+
+        glUseProgram(m_shadowProgram);
+        setBakeUniforms(m_shadowProgram, domainSize, stepSize, directions, numLights);
+        glBindImageTexture(0, shadowMap, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+        glDispatchCompute((dimX + 7) / 8, (dimZ + 7) / 8, 1);
+
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+        glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+
+        glBindTexture(GL_TEXTURE_3D, 0);
+        glUseProgram(0);
+    }
+
+private:
+    static GLuint createProgram(const std::string &filename) {
+        return ShaderManager::instance().createCompute(filename, [](GLuint program) {
+            glUseProgram(program);
+            setUniform(program, "u_volume", 0);
+            glUseProgram(0);
+        });
+    }
+
+    static void setBakeUniforms(GLuint program, const glm::vec3 &domainSize, float stepSize, const glm::vec3 *directions, int numLights) {
+        setUniform(program, "u_domainSize", domainSize);
+        setUniform(program, "u_stepSize", stepSize);
+        setUniform(program, "u_numLights", numLights);
+        for (int i = 0; i < numLights; i++) {
+            setUniform(program, "u_lightDirs[" + std::to_string(i) + "]", directions[i]);
+        }
+    }
+
+    static int texels(int voxels) {
+        return glm::max(voxels / DOWNSCALE, 1);
+    }
+};
+
+#endif // LIGHT_TRANSMITTANCE_HPP
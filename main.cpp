@@ -3,11 +3,20 @@
 #include "mesh.hpp"
 #include "camera.hpp"
 #include "shader.hpp"
+#include "shadermanager.hpp"
+#include "shadervariants.hpp"
 #include "object3d.hpp"
 #include "framebuffer.hpp"
+#include "cloudbuffer.hpp"
+#include "bluenoise.hpp"
+#include "tilestats.hpp"
+#include "lightculling.hpp"
+#include "renderscale.hpp"
 #include "voxeltexture.hpp"
-#include "cloudsmanager.hpp"
+#include "CloudsManager.hpp"
 #include "scene.hpp"
+#include "benchmark.hpp"
+#include "profiler.hpp"
 
 #include "imgui.h"
 #include "imgui_impl_glfw.h"
@@ -28,9 +37,18 @@ GLFWwindow *g_window {};
 // GPU objects
 GLuint g_geometryShader {};  // A GPU program contains at least a vertex shader and a fragment shader
 GLuint g_lightingShader {}; // A GPU program contains at least a vertex shader and a fragment shader
+GLuint g_cloudShader {};    // Raymarches the clouds, at a lower resolution
+
+// The two programs above are the variants of these for the current volume parameters and light types, see render()
+ShaderVariants g_lightingVariants {};
+ShaderVariants g_cloudVariants {};
 
 
 std::shared_ptr<FrameBuffer> g_framebuffer {};
+CloudHistory g_cloudHistory {};
+BlueNoise g_blueNoise {};
+TileStatistics g_tileStatistics {};
+LightCulling g_lightCulling {};
 
 VoxelTexture g_voxelTexture {};
 CloudsManager g_cloudsManager {};
@@ -38,10 +56,21 @@ CloudsManager g_cloudsManager {};
 
 Scene g_scene {};
 
+Benchmark g_benchmark {};
+
+GpuProfiler g_profiler {};
+RenderScale g_renderScale {};
+int g_voxelStage {};
+int g_geometryStage {};
+int g_lightCullingStage {};
+int g_cloudStage {};
+int g_lightingStage {};
+int g_uiStage {};
 
 float g_fps = 0.0f;
 
 // Executed each time the window is resized. Adjust the aspect ratio and the rendering viewport to the current window.
+// The render targets follow the framebuffer size and the render scale at the start of each frame.
 void windowSizeCallback(GLFWwindow *window, int width, int height) {
     g_scene.m_camera.setAspectRatio(static_cast<float>(width) / static_cast<float>(height));
     glViewport(0, 0, (GLint)width, (GLint)height);  // Dimension of the rendering region in the window
@@ -96,9 +125,19 @@ void errorCallback(int error, const char *desc) {
     std::cout << "Error " << error << ": " << desc << std::endl;
 }
 
+bool g_useNullPlatform = false;
+
 void initGLFW() {
     glfwSetErrorCallback(errorCallback);
 
+#ifdef GLFW_PLATFORM_NULL
+    // Without any display server (e.g. in CI), the benchmark falls back to the null platform with a surfaceless context
+    if(g_benchmark.m_params.enabled && !std::getenv("DISPLAY") && !std::getenv("WAYLAND_DISPLAY")) {
+        glfwInitHint(GLFW_PLATFORM, GLFW_PLATFORM_NULL);
+        g_useNullPlatform = true;
+    }
+#endif
+
     // Initialize GLFW, the library responsible for window management
     if (!glfwInit()) {
         std::cerr << "ERROR: Failed to init GLFW" << std::endl;
@@ -112,6 +151,13 @@ void initGLFW() {
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
     glfwWindowHint(GLFW_RESIZABLE, GL_TRUE);
 
+    if(g_benchmark.m_params.enabled) {
+        glfwWindowHint(GLFW_VISIBLE, GL_FALSE); // Offscreen rendering, the window is never shown
+#ifdef GLFW_PLATFORM_NULL
+        if(g_useNullPlatform) glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_EGL_CONTEXT_API); // Surfaceless EGL context
+#endif
+    }
+
     // Create the window
     g_window = glfwCreateWindow(
         1024, 768,
@@ -161,16 +207,64 @@ void initOpenGL() {
     glfwSwapInterval(0);
 }
 
+// Texture units never change, so the samplers are set once per link
+void setVolumeSamplers(GLuint program) {
+    bindUniformBlock(program, "CameraBlock", CAMERA_BLOCK_BINDING);
+    bindUniformBlock(program, "VolumeBlock", VOLUME_BLOCK_BINDING);
+    bindUniformBlock(program, "LightsBlock", LIGHTS_BLOCK_BINDING);
+
+    glUseProgram(program);
+    setUniform(program, "u_Depth", 0);
+    setUniform(program, "u_voxelTexture", 3);
+    setUniform(program, "u_voxelTextureNext", 4);
+    setUniform(program, "u_occupancy", 5);
+    setUniform(program, "u_occupancyNext", 6);
+    setUniform(program, "u_transmittance", 7);
+    setUniform(program, "u_transmittanceNext", 8);
+    setUniform(program, "u_cloudShadow", 9);
+    setUniform(program, "u_cloudShadowNext", 10);
+}
+
 void initGPUprogram() {
-    g_geometryShader = glCreateProgram();  // Create a GPU program, i.e., two central shaders of the graphics pipeline
-    loadShader(g_geometryShader, GL_VERTEX_SHADER, "../resources/geometryVertex.glsl");
-    loadShader(g_geometryShader, GL_FRAGMENT_SHADER, "../resources/geometryFragment.glsl");
-    glLinkProgram(g_geometryShader);  // The main GPU program is ready to be handle streams of polygons
-
-    g_lightingShader = glCreateProgram();  // Create a GPU program, i.e., two central shaders of the graphics pipeline
-    loadShader(g_lightingShader, GL_VERTEX_SHADER, "../resources/lightingVertex.glsl");
-    loadShader(g_lightingShader, GL_FRAGMENT_SHADER, "../resources/lightingFragment.glsl");
-    glLinkProgram(g_lightingShader);  // The main GPU program is ready to be handle streams of polygons
+    // Loaded from the binary cache when the sources did not change, and rebuilt in place when they are edited.
+    // The variants of the lighting and cloud programs are built on first use, by render().
+    ShaderManager &shaders = ShaderManager::instance();
+
+    g_geometryShader = shaders.create({ { GL_VERTEX_SHADER, "../resources/geometryVertex.glsl" },
+                                        { GL_FRAGMENT_SHADER, "../resources/geometryFragment.glsl" } },
+                                      [](GLuint program) {
+        bindUniformBlock(program, "CameraBlock", CAMERA_BLOCK_BINDING);
+    });
+
+    g_lightingVariants.init({ { GL_VERTEX_SHADER, "../resources/lightingVertex.glsl" },
+                              { GL_FRAGMENT_SHADER, "../resources/lightingFragment.glsl" } },
+                            [](GLuint program) {
+        setVolumeSamplers(program);
+        setUniform(program, "u_Normal", 1);
+        setUniform(program, "u_Albedo", 2);
+        setUniform(program, "u_cloud", 11);
+        setUniform(program, "u_cloudDistance", 12);
+        glUseProgram(0);
+    });
+
+    g_cloudVariants.init({ { GL_VERTEX_SHADER, "../resources/lightingVertex.glsl" },
+                           { GL_FRAGMENT_SHADER, "../resources/cloudFragment.glsl" } },
+                         [](GLuint program) {
+        setVolumeSamplers(program);
+        setUniform(program, "u_historyCloud", 13);
+        setUniform(program, "u_historyDistance", 14);
+        setUniform(program, "u_blueNoise", 15);
+        setUniform(program, "u_tileBudget", 16);
+        setUniform(program, "u_tileSize", TileStatistics::TILE_SIZE);
+        glUseProgram(0);
+    });
+}
+
+// Uniforms of the volume textures, shared by the cloud and lighting programs
+void setVolumeUniforms(GLuint program) {
+    setUniform(program, "u_keyframeBlend", g_voxelTexture.keyframeBlend());
+    setUniform(program, "u_occupancyLevels", g_voxelTexture.occupancyLevels());
+    setUniform(program, "u_useTransmittance", g_voxelTexture.m_bakedTransmittance);
 }
 
 
@@ -183,31 +277,67 @@ void init() {
 
     g_scene.init(width, height);
     initGPUprogram();
-    
+    g_voxelTexture.init();
+    g_blueNoise.init();
+    g_tileStatistics.init();
+    g_lightCulling.init();
+
     initImGui();
 
     g_cloudsManager.setDefaults();
+    g_cloudsManager.initUniformBuffer();
+
+    g_voxelStage = g_profiler.addStage("Voxel generation");
+    g_geometryStage = g_profiler.addStage("Geometry pass");
+    g_lightCullingStage = g_profiler.addStage("Light culling");
+    g_cloudStage = g_profiler.addStage("Cloud pass");
+    g_lightingStage = g_profiler.addStage("Lighting pass");
+    g_uiStage = g_profiler.addStage("UI");
 }
 
 void clear() {
-    glDeleteProgram(g_geometryShader);
-
-    glfwDestroyWindow(g_window);
-    glfwTerminate();
+    ShaderManager::instance().stopWatching();
+    ShaderManager::instance().destroy(g_geometryShader);
+    g_lightingVariants.release();
+    g_cloudVariants.release();
+
+    // Every GL object is deleted while the context exists, the destructors of the globals then have nothing left to do
+    g_framebuffer.reset();
+    g_cloudHistory.release();
+    g_blueNoise.release();
+    g_tileStatistics.release();
+    g_lightCulling.release();
+    g_voxelTexture.release();
+    g_cloudsManager.release();
+    g_scene.release();
+    g_profiler.release();
+    g_renderScale.release();
 
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplGlfw_Shutdown();
     ImGui::DestroyContext();
-}
 
-bool g_triggerRecompute = true;
+    glfwDestroyWindow(g_window);
+    glfwTerminate();
+}
 
 void renderPerfsUI() {
     ImGui::Begin("Performance", nullptr, ImGuiWindowFlags_AlwaysAutoResize);
 
     ImGui::Text("FPS: %.1f", g_fps);
     ImGui::Text("Frame time: %.3f ms", 1000.0f / g_fps);
-    
+
+    g_profiler.renderUI();
+
+    ImGui::Separator();
+    g_renderScale.renderUI();
+
+    ImGui::Separator();
+    ShaderManager::instance().renderUI();
+
+    if (ImGui::Checkbox("Specialized shaders", &g_cloudVariants.m_enabled)) g_lightingVariants.m_enabled = g_cloudVariants.m_enabled;
+    ImGui::Text("Variants: %d cloud, %d lighting", g_cloudVariants.size(), g_lightingVariants.size());
+
     ImGui::End();
 }
 void renderLightsUI() {
@@ -227,6 +357,7 @@ void renderLightsUI() {
                     const bool is_selected = (comboLabel == items[n]);
                     if (ImGui::Selectable(items[n], is_selected)) {
                         light.type = n;
+                        if (n == 1 && light.radius < MIN_LIGHT_RADIUS) light.radius = DEFAULT_LIGHT_RADIUS; // Only point lights use it
                     }
                     if (is_selected) {
                         ImGui::SetItemDefaultFocus();   // You may set the initial focus when opening the combo (scrolling + for keyboard navigation support)
@@ -239,6 +370,8 @@ void renderLightsUI() {
                 ImGui::SliderFloat3(((light.type == 1 ? "Position" : "Direction") + std::to_string(i)).c_str(), &light.position.x, -10.0f, 10.0f);
             ImGui::ColorEdit3(("Color" + std::to_string(i)).c_str(), &light.color.x);
             ImGui::SliderFloat(("Intensity" + std::to_string(i)).c_str(), &light.intensity, 0.0f, light.type == 0 ? 1.0f : 10.0f);
+            if(light.type == 1)
+                ImGui::SliderFloat(("Radius" + std::to_string(i)).c_str(), &light.radius, MIN_LIGHT_RADIUS, 100.0f);
         }
     }
     if(g_scene.m_numLights < MAX_LIGHTS) {
@@ -247,7 +380,8 @@ void renderLightsUI() {
                 1,
                 glm::vec3(0.0f, 0.0f, 0.0f),
                 glm::vec3(1.0, 1.0, 1.0),
-                1.0f
+                1.0f,
+                DEFAULT_LIGHT_RADIUS
             };
         }
         ImGui::SameLine();
@@ -255,6 +389,10 @@ void renderLightsUI() {
     if(g_scene.m_numLights > 0 && ImGui::Button("Remove light")) {
         g_scene.m_numLights--;
     }
+    if(g_lightCulling.m_overflowTiles > 0) {
+        ImGui::Text("WARNING: %u tiles over %d lights (up to %u), their last point lights are dropped",
+                    g_lightCulling.m_overflowTiles, LightCulling::MAX_LIGHTS_PER_TILE, g_lightCulling.m_maxTileLights);
+    }
 
     ImGui::End();
 }
@@ -267,7 +405,8 @@ void renderUI() {
 
     renderPerfsUI();
     renderLightsUI();
-    if(g_cloudsManager.renderUI()) g_triggerRecompute = true;
+    g_cloudsManager.renderUI();
+    g_voxelTexture.renderUI();
 
     // End drawing here
 
@@ -277,9 +416,25 @@ void renderUI() {
 
 // The main rendering call
 void render() {
-    
+    g_scene.updateUniformBuffers();
+    g_cloudsManager.updateUniformBuffer();
+
+    // Raymarching programs specialized for the current volume parameters and light types, compiled on first use
+    std::string variant = g_cloudsManager.variantDefines() + g_scene.lightTypeDefines();
+    g_cloudShader = g_cloudVariants.get(variant);
+    g_lightingShader = g_lightingVariants.get(variant);
+
+    // Render resolution, a fraction of the window size when the frame time is over budget
+    int outputWidth, outputHeight;
+    glfwGetFramebufferSize(g_window, &outputWidth, &outputHeight);
+    int width, height;
+    g_renderScale.resize(outputWidth, outputHeight, width, height);
+    g_framebuffer->resize(width, height);
+
     // Geometry pass
+    g_profiler.begin(g_geometryStage);
     glBindFramebuffer(GL_FRAMEBUFFER, g_framebuffer->m_Buffer);
+    glViewport(0, 0, width, height);
 
     glClearColor(0.0f, 0.0f, 0.0f, 1.0f);  // specify the background color, used any time the framebuffer is cleared
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);  // Erase the color and z buffers.
@@ -287,35 +442,94 @@ void render() {
 
     g_scene.geometryPass(g_geometryShader);
 
-    // Post-process pass
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-    glUseProgram(g_lightingShader);
+    // Lights reaching each tile of the G-buffer
+    g_profiler.begin(g_lightCullingStage);
+    g_lightCulling.cull(g_framebuffer->m_depth, g_framebuffer->m_Width, g_framebuffer->m_Height);
 
-    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);  // specify the background color, used any time the framebuffer is cleared
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);  // Erase the color and z buffers.
-
-    setUniform(g_lightingShader, "u_Position", 0);
-    setUniform(g_lightingShader, "u_Normal", 1);
-    setUniform(g_lightingShader, "u_Albedo", 2);
+    // Cloud pass, at a fraction of the G-buffer resolution, and only on a fraction of the pixels each frame
+    g_profiler.begin(g_cloudStage);
+    const CloudPassParams &cloudPass = g_cloudsManager.m_cloudPassParams;
+    int divider = cloudPass.resolutionDivider;
+    g_cloudHistory.beginFrame(glm::max(g_framebuffer->m_Width / divider, 1), glm::max(g_framebuffer->m_Height / divider, 1));
+    CloudBuffer &cloudBuffer = g_cloudHistory.current();
 
-    const glm::mat4 viewMatrix = g_scene.m_camera.computeViewMatrix();
-    const glm::mat4 projMatrix = g_scene.m_camera.computeProjectionMatrix();
+    // Ray budget of each tile, from the previous frame
+    bool budgetValid = g_cloudHistory.m_valid && cloudPass.tileBudgets;
+    g_tileStatistics.compute(g_cloudHistory.history().m_color, cloudBuffer.m_width, cloudBuffer.m_height, budgetValid, cloudPass.minBudget);
 
-    setUniform(g_lightingShader, "u_viewMat", viewMatrix);
-    setUniform(g_lightingShader, "u_projMat", projMatrix);
-    setUniform(g_lightingShader, "u_invViewMat", glm::inverse(viewMatrix));
-    setUniform(g_lightingShader, "u_invProjMat", glm::inverse(projMatrix));
+    glBindFramebuffer(GL_FRAMEBUFFER, cloudBuffer.m_buffer);
+    glViewport(0, 0, cloudBuffer.m_width, cloudBuffer.m_height);
+    glDisable(GL_DEPTH_TEST);
+    glUseProgram(g_cloudShader);
 
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, g_framebuffer->m_depth);
     glActiveTexture(GL_TEXTURE3);
     glBindTexture(GL_TEXTURE_3D, g_voxelTexture.textureID);
+    glActiveTexture(GL_TEXTURE4);
+    glBindTexture(GL_TEXTURE_3D, g_voxelTexture.nextTextureID());
+
+    glActiveTexture(GL_TEXTURE5);
+    glBindTexture(GL_TEXTURE_3D, g_voxelTexture.occupancyTextureID());
+    glActiveTexture(GL_TEXTURE6);
+    glBindTexture(GL_TEXTURE_3D, g_voxelTexture.nextOccupancyTextureID());
+    glActiveTexture(GL_TEXTURE7);
+    glBindTexture(GL_TEXTURE_3D, g_voxelTexture.transmittanceTextureID());
+    glActiveTexture(GL_TEXTURE8);
+    glBindTexture(GL_TEXTURE_3D, g_voxelTexture.nextTransmittanceTextureID());
+    glActiveTexture(GL_TEXTURE9);
+    glBindTexture(GL_TEXTURE_2D, g_voxelTexture.shadowMapID());
+    glActiveTexture(GL_TEXTURE10);
+    glBindTexture(GL_TEXTURE_2D, g_voxelTexture.nextShadowMapID());
+
+    setVolumeUniforms(g_cloudShader);
+    g_lightCulling.setUniforms(g_cloudShader);
+
+    glActiveTexture(GL_TEXTURE13);
+    glBindTexture(GL_TEXTURE_2D, g_cloudHistory.history().m_color);
+    glActiveTexture(GL_TEXTURE14);
+    glBindTexture(GL_TEXTURE_2D, g_cloudHistory.history().m_distance);
+
+    // Width of a pixel of the cloud pass per world unit from the camera, for the level of detail of the density
+    glm::mat4 projMatrix = g_scene.m_camera.computeProjectionMatrix();
+    setUniform(g_cloudShader, "u_pixelSpread", 2.0f / (projMatrix[1][1] * cloudBuffer.m_height));
+
+    setUniform(g_cloudShader, "u_historyValid", g_cloudHistory.m_valid);
+    setUniform(g_cloudShader, "u_prevProjViewMat", g_cloudHistory.m_prevProjViewMat);
+    setUniform(g_cloudShader, "u_prevCameraPosition", g_cloudHistory.m_prevCameraPosition);
+    setUniform(g_cloudShader, "u_updateInterval", cloudPass.updateInterval);
+    setUniform(g_cloudShader, "u_updateIndex", g_cloudHistory.updateIndex(cloudPass.updateInterval));
+
+    glActiveTexture(GL_TEXTURE15);
+    glBindTexture(GL_TEXTURE_2D, g_blueNoise.m_texture);
+    glActiveTexture(GL_TEXTURE16);
+    glBindTexture(GL_TEXTURE_2D, g_tileStatistics.m_texture);
+    setUniform(g_cloudShader, "u_jitterRays", cloudPass.jitterRays);
+    setUniform(g_cloudShader, "u_frameIndex", g_cloudHistory.m_frame);
+    setUniform(g_cloudShader, "u_historyWeight", cloudPass.historyWeight);
 
-    setUniform(g_lightingShader, "u_voxelTexture", 3);
+    glBindVertexArray(g_framebuffer->m_quad->m_vao);
+    glDrawElements(GL_TRIANGLES, g_framebuffer->m_quad->m_numIndices, GL_UNSIGNED_INT, 0);
 
-    g_scene.setUniforms(g_lightingShader);
-    g_cloudsManager.setUniforms(g_lightingShader);
+    g_cloudHistory.endFrame(g_scene.m_camera.computeProjectionMatrix() * g_scene.m_camera.computeViewMatrix(), g_scene.m_camera.getPosition());
+
+    // Post-process pass: opaque lighting, sky, and upsampled clouds, at the render resolution
+    g_profiler.begin(g_lightingStage);
+    glBindFramebuffer(GL_FRAMEBUFFER, g_renderScale.m_buffer);
+    glViewport(0, 0, width, height);
+    glUseProgram(g_lightingShader);
+
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);  // specify the background color, used any time the framebuffer is cleared
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);  // Erase the color and z buffers.
+
+    setVolumeUniforms(g_lightingShader);
+    g_lightCulling.setUniforms(g_lightingShader);
+
+    glActiveTexture(GL_TEXTURE11);
+    glBindTexture(GL_TEXTURE_2D, cloudBuffer.m_color);
+    glActiveTexture(GL_TEXTURE12);
+    glBindTexture(GL_TEXTURE_2D, cloudBuffer.m_distance);
 
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, g_framebuffer->m_position);
     glActiveTexture(GL_TEXTURE1);
     glBindTexture(GL_TEXTURE_2D, g_framebuffer->m_normal);
     glActiveTexture(GL_TEXTURE2);
@@ -323,12 +537,20 @@ void render() {
 
     glBindVertexArray(g_framebuffer->m_quad->m_vao);
     glDrawElements(GL_TRIANGLES, g_framebuffer->m_quad->m_numIndices, GL_UNSIGNED_INT, 0);
+    glEnable(GL_DEPTH_TEST);
 
-    renderUI();
+    // Upscaled to the window, the UI is drawn at the full resolution on top
+    g_renderScale.blit(outputWidth, outputHeight);
+    glViewport(0, 0, outputWidth, outputHeight);
+
+    if(!g_benchmark.m_params.enabled) {
+        g_profiler.begin(g_uiStage);
+        renderUI();
+    }
+    g_profiler.end();
 }
 
 
-int frameCount = 0;
 // Update any accessible variable based on the current time
 void update(const float currentTimeInSec) {
 
@@ -357,22 +579,76 @@ void update(const float currentTimeInSec) {
     cameraOffset = g_cameraDistance * rot1 * rot2 * cameraOffset;
     
     g_scene.m_camera.setPosition(targetPosition + glm::vec3(cameraOffset));
+    g_scene.m_time = currentTimeInSec;
 
-    if(frameCount % 1 == 0) g_triggerRecompute = true;
+    // Regenerates the volume only if the parameters or the time changed, then the light transmittance if out of date
+    g_profiler.begin(g_voxelStage);
+    g_voxelTexture.update(g_cloudsManager.m_generationParams, currentTimeInSec);
+
+    glm::vec3 lightDirections[LightTransmittance::MAX_LIGHTS];
+    int numDirections = g_scene.transmittanceDirections(lightDirections);
+    g_voxelTexture.updateTransmittance(lightDirections, numDirections);
+    g_profiler.end();
+}
 
-    if(g_triggerRecompute) {
-        g_voxelTexture.generateTexture(g_cloudsManager.m_generationParams.domainSize, g_cloudsManager.m_generationParams.domainCenter);
-        g_triggerRecompute = false;
+// Replays the scripted camera path with a fixed time step, and writes the frame timings to a JSON file
+int runBenchmark() {
+    int width, height;
+    glfwGetFramebufferSize(g_window, &width, &height);
+
+    for(int frame = 0; frame < g_benchmark.totalFrames() && !glfwWindowShouldClose(g_window); frame++) {
+        g_benchmark.cameraPath(frame, g_yaw, g_pitch, g_cameraDistance);
+
+        // The GPU timings are collected GpuProfiler::NUM_BUFFERS frames late: the first measured frame is collected then
+        if(frame == g_benchmark.m_params.warmupFrames + GpuProfiler::NUM_BUFFERS) g_profiler.resetTotals();
+
+        g_benchmark.beginFrame();
+        g_profiler.beginFrame();
+        update(g_benchmark.frameTime(frame));
+        render();
+        g_profiler.endFrame();
+        g_benchmark.endFrame(frame, g_voxelTexture.m_frameEncodeMs);
+
+        glfwSwapBuffers(g_window);
+        glfwPollEvents();
     }
+    g_profiler.flush(); // The last measured frames
 
-    frameCount++;
+    return g_benchmark.writeResults(width, height, g_profiler, g_voxelTexture.m_format, g_voxelTexture.memoryUsage()) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
 int main(int argc, char **argv) {
+    if(!g_benchmark.parseArgs(argc, argv)) return EXIT_FAILURE;
+
+    if(g_benchmark.m_params.cpuGenerator) { // No OpenGL needed
+        g_cloudsManager.setDefaults();
+        CpuGenerator::benchmark(g_voxelTexture.cpuParams(g_cloudsManager.m_generationParams, 0.0f));
+        return EXIT_SUCCESS;
+    }
+
+    if(g_benchmark.m_params.volumeFormat >= 0) g_voxelTexture.m_format = g_benchmark.m_params.volumeFormat;
+    g_voxelTexture.m_presetTime = g_benchmark.m_params.weatherTime;
+
     init();
+    if(g_benchmark.m_params.enabled) {
+        g_renderScale.m_enabled = false; // Measured at the window resolution, to compare the runs
+        int result = runBenchmark();
+        clear();
+        return result;
+    }
+    ShaderManager::instance().startWatching();
+    double lastFrameTime = glfwGetTime();
     while (!glfwWindowShouldClose(g_window)) {
+        ShaderManager::instance().reloadChanged();
+
+        double frameTime = glfwGetTime();
+        g_renderScale.update(static_cast<float>((frameTime - lastFrameTime) * 1000.0));
+        lastFrameTime = frameTime;
+
+        g_profiler.beginFrame();
         update(static_cast<float>(glfwGetTime()));
         render();
+        g_profiler.endFrame();
         glfwSwapBuffers(g_window);
         glfwPollEvents();
     }
@@ -0,0 +1,90 @@
+#ifndef NOISE_TEXTURES_HPP
+#define NOISE_TEXTURES_HPP
+
+#include "gl_includes.hpp"
+#include "hash.hpp"
+#include "shader.hpp"
+#include "shadermanager.hpp"
+#include "volumecache.hpp"
+
+// Tileable 3D noise textures, baked once at startup by noise.glsl and sampled with GL_REPEAT.
+// The base texture holds the low-frequency shapes, the detail texture the high-frequency erosion.
+// The first level is loaded from the volume cache when a previous run already baked it.
+class NoiseTextures {
+public:
+    GLuint m_baseNoise {};
+    GLuint m_detailNoise {};
+
+    int m_baseResolution = 128;
+    int m_detailResolution = 32;
+
+public:
+    NoiseTextures() = default;
+
+    ~NoiseTextures() {
+        release();
+    }
+
+    void release() {
+        if (m_baseNoise) glDeleteTextures(1, &m_baseNoise);
+        if (m_detailNoise) glDeleteTextures(1, &m_detailNoise);
+        m_baseNoise = m_detailNoise = 0;
+    }
+
+    void bake(VolumeCache &cache) {
+        std::string source = file2String("../resources/noise.glsl");
+        uint64_t version = hashBytes(source.data(), source.size());
+
+        GLuint program = 0; // Only compiled if a texture is not in the cache
+
+        m_baseNoise = bakeTexture(m_baseResolution, 0, cache, version, program);
+        m_detailNoise = bakeTexture(m_detailResolution, 1, cache, version, program);
+
+        ShaderManager::instance().destroy(program);
+    }
+
+private:
+    static GLuint bakeTexture(int resolution, int detail, VolumeCache &cache, uint64_t version, GLuint &program) {
+        int levels = 1;
+        while ((resolution >> levels) > 0) levels++;
+
+        GLuint texture {};
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_3D, texture);
+        glTexStorage3D(GL_TEXTURE_3D, levels, GL_RGBA8, resolution, resolution, resolution);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_REPEAT);
+
+        const uint32_t dim[3] = { static_cast<uint32_t>(resolution), static_cast<uint32_t>(resolution), static_cast<uint32_t>(resolution) };
+        const int key[2] = { resolution, detail };
+        uint64_t keyHash = hashBytes(key, sizeof(key), hashBytes("noise", 5));
+
+        if (!cache.load(version, keyHash, dim, GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE)) {
+            if (!program) {
+                program = ShaderManager::instance().createCompute("../resources/noise.glsl");
+            }
+
+            glUseProgram(program);
+            setUniform(program, "u_resolution", resolution);
+            setUniform(program, "u_detail", detail);
+
+            glBindImageTexture(0, texture, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_RGBA8);
+            glDispatchCompute(resolution / 8, resolution / 8, resolution / 8);
+            glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+            glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+            glUseProgram(0);
+
+            cache.store(version, keyHash, dim, GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, 4);
+        }
+
+        glGenerateMipmap(GL_TEXTURE_3D);
+        glBindTexture(GL_TEXTURE_3D, 0);
+
+        return texture;
+    }
+};
+
+#endif // NOISE_TEXTURES_HPP
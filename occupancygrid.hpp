@@ -0,0 +1,88 @@
+#ifndef OCCUPANCY_GRID_HPP
+#define OCCUPANCY_GRID_HPP
+
+#include "gl_includes.hpp"
+#include "shader.hpp"
+#include "shadermanager.hpp"
+
+// Low-resolution max-density grid of a density volume, used by the raymarcher to jump over empty space.
+// Level 0 holds the max of each BRICK_SIZE^3 brick (plus a 1-voxel border, for the trilinear footprint),
+// and each of the NUM_LEVELS - 1 next levels the max of 2x2x2 cells of the previous one. Built by occupancy.glsl.
+class OccupancyGrid {
+public:
+    static const int BRICK_SIZE = 8;
+    static const int NUM_LEVELS = 4; // The raymarcher starts from the coarsest one
+
+    GLuint m_program {};
+
+public:
+    OccupancyGrid() = default;
+
+    ~OccupancyGrid() {
+        release();
+    }
+
+    void release() {
+        ShaderManager::instance().destroy(m_program);
+        m_program = 0;
+    }
+
+    void init() {
+        m_program = ShaderManager::instance().createCompute("../resources/occupancy.glsl", [](GLuint program) {
+            glUseProgram(program);
+            setUniform(program, "u_volume", 0);
+            setUniform(program, "u_brickSize", BRICK_SIZE);
+            glUseProgram(0);
+        });
+    }
+
+    // Grid texture for a volume of the given size
+    static GLuint create(int dimX, int dimY, int dimZ) {
+        GLuint texture {};
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_3D, texture);
+        // R32F: a tiny positive density must not round to an empty cell
+        glTexStorage3D(GL_TEXTURE_3D, NUM_LEVELS, GL_R32F, cells(dimX), cells(dimY), cells(dimZ));
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAX_LEVEL, NUM_LEVELS - 1);
+        glBindTexture(GL_TEXTURE_3D, 0);
+
+        return texture;
+    }
+
+    // Rebuilds every level of grid from the current content of volume
+    void build(GLuint volume, GLuint grid, int dimX, int dimY, int dimZ) const {
+        glUseProgram(m_program);
+
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_3D, volume);
+
+        int sizeX = cells(dimX), sizeY = cells(dimY), sizeZ = cells(dimZ);
+        for (int level = 0; level < NUM_LEVELS; level++) {
+            setUniform(m_program, "u_level", level);
+
+            glBindImageTexture(0, grid, level, GL_TRUE, 0, GL_WRITE_ONLY, GL_R32F);
+            if (level > 0) glBindImageTexture(1, grid, level - 1, GL_TRUE, 0, GL_READ_ONLY, GL_R32F);
+
+            glDispatchCompute((sizeX + 3) / 4, (sizeY + 3) / 4, (sizeZ + 3) / 4);
+            glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+
+            sizeX = glm::max(sizeX / 2, 1);
+            sizeY = glm::max(sizeY / 2, 1);
+            sizeZ = glm::max(sizeZ / 2, 1);
+        }
+
+        glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+        glBindImageTexture(1, 0, 0, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+        glBindTexture(GL_TEXTURE_3D, 0);
+        glUseProgram(0);
+    }
+
+private:
+    static int cells(int voxels) {
+        return (voxels + BRICK_SIZE - 1) / BRICK_SIZE;
+    }
+};
+
+#endif // OCCUPANCY_GRID_HPP
@@ -0,0 +1,157 @@
+#ifndef PROFILER_HPP
+#define PROFILER_HPP
+
+#include "gl_includes.hpp"
+
+#include "imgui.h"
+
+#include <cfloat>
+#include <string>
+#include <vector>
+
+// Measures the GPU time of each stage of the frame with GL_TIME_ELAPSED queries.
+// The queries are double-buffered: the results of a frame are read two frames later, so reading them never stalls the pipeline.
+// Stages must not overlap, as only one GL_TIME_ELAPSED query can be active at a time.
+class GpuProfiler {
+public:
+    static const int NUM_BUFFERS = 2;
+    static const int HISTORY_SIZE = 128;
+
+    struct Stage {
+        std::string name {};
+
+        GLuint queries[NUM_BUFFERS] {};
+        bool issued[NUM_BUFFERS] {};
+
+        float history[HISTORY_SIZE] {}; // In ms, rolling buffer indexed by m_historyIndex, 0 when the stage did not run
+        bool recorded[HISTORY_SIZE] {};  // The stage ran in the frame of history[i]
+        float lastMs = 0.0f;
+        float averageMs = 0.0f; // Over the frames of the history the stage ran in
+
+        double totalMs = 0.0; // Since the last reset, for the benchmark
+        int numSamples = 0;
+    };
+
+    std::vector<Stage> m_stages {};
+
+private:
+    int m_frame = 0;
+    int m_historyIndex = 0;
+    int m_activeStage = -1;
+
+public:
+    GpuProfiler() = default;
+
+    ~GpuProfiler() {
+        release();
+    }
+
+    // Deletes the queries, while the context is still alive
+    void release() {
+        for(Stage &stage : m_stages) glDeleteQueries(NUM_BUFFERS, stage.queries);
+        m_stages.clear();
+    }
+
+    // Returns the id to pass to begin()
+    int addStage(const std::string &name) {
+        Stage stage {};
+        stage.name = name;
+        glGenQueries(NUM_BUFFERS, stage.queries);
+        m_stages.push_back(stage);
+
+        return static_cast<int>(m_stages.size()) - 1;
+    }
+
+    void begin(int stage) {
+        if(m_activeStage != -1) end();
+
+        Stage &s = m_stages[stage];
+        glBeginQuery(GL_TIME_ELAPSED, s.queries[m_frame % NUM_BUFFERS]);
+        s.issued[m_frame % NUM_BUFFERS] = true;
+        m_activeStage = stage;
+    }
+
+    void end() {
+        if(m_activeStage == -1) return;
+
+        glEndQuery(GL_TIME_ELAPSED);
+        m_activeStage = -1;
+    }
+
+    // Collects the results issued NUM_BUFFERS frames ago, whose query objects are about to be reused
+    void beginFrame() {
+        if(m_frame < NUM_BUFFERS) return;
+        collect(m_frame % NUM_BUFFERS);
+    }
+
+    void endFrame() {
+        end();
+        m_frame++;
+    }
+
+    // Collects the results of the last NUM_BUFFERS frames, still pending after the last endFrame(), oldest first
+    void flush() {
+        for(int frame = m_frame - NUM_BUFFERS; frame < m_frame; frame++) {
+            if(frame >= 0) collect(frame % NUM_BUFFERS);
+        }
+    }
+
+    float totalAverageMs() const {
+        float total = 0.0f;
+        for(const Stage &stage : m_stages) total += stage.averageMs;
+        return total;
+    }
+
+    // Restarts the totals from the next frame collected, i.e. the frame issued NUM_BUFFERS frames before the next beginFrame()
+    void resetTotals() {
+        for(Stage &stage : m_stages) {
+            stage.totalMs = 0.0;
+            stage.numSamples = 0;
+        }
+    }
+
+    // Breakdown of the GPU frame, to be called inside an ImGui window
+    void renderUI() const {
+        ImGui::Separator();
+        ImGui::Text("GPU: %.3f ms", totalAverageMs());
+
+        for(const Stage &stage : m_stages) {
+            ImGui::Text("%-20s %7.3f ms (avg %.3f ms)", stage.name.c_str(), stage.lastMs, stage.averageMs);
+            ImGui::PlotLines(("##" + stage.name).c_str(), stage.history, HISTORY_SIZE, (m_historyIndex + 1) % HISTORY_SIZE,
+                             nullptr, 0.0f, FLT_MAX, ImVec2(250, 30));
+        }
+    }
+
+private:
+    void collect(int buffer) {
+        m_historyIndex = (m_historyIndex + 1) % HISTORY_SIZE;
+
+        for(Stage &stage : m_stages) {
+            float ms = 0.0f;
+            bool recorded = stage.issued[buffer];
+            if(recorded) {
+                GLuint64 elapsed = 0;
+                glGetQueryObjectui64v(stage.queries[buffer], GL_QUERY_RESULT, &elapsed);
+                ms = static_cast<float>(elapsed) * 1e-6f;
+                stage.issued[buffer] = false;
+            }
+
+            stage.lastMs = ms;
+            stage.history[m_historyIndex] = ms;
+            stage.recorded[m_historyIndex] = recorded;
+            stage.totalMs += ms;
+            stage.numSamples++;
+
+            float sum = 0.0f;
+            int count = 0;
+            for(int i = 0; i < HISTORY_SIZE; i++) {
+                if(!stage.recorded[i]) continue;
+                sum += stage.history[i];
+                count++;
+            }
+            stage.averageMs = count > 0 ? sum / count : 0.0f;
+        }
+    }
+};
+
+#endif // PROFILER_HPP
@@ -0,0 +1,128 @@
+#ifndef RENDER_SCALE_HPP
+#define RENDER_SCALE_HPP
+
+#include "gl_includes.hpp"
+
+#include "imgui.h"
+
+#include <cmath>
+#include <iostream>
+
+// Dynamic resolution. The G-buffer, the cloud pass and the lighting pass run at m_scale times the resolution of the
+// window, into m_buffer, which is then upscaled to the window with a bilinear blit.
+// The scale follows the smoothed frame time, in steps of 1 / SCALE_STEPS: it goes down when the frame time is over
+// the target by more than m_upperMargin, up when it is under by more than m_lowerMargin, and then stays still for
+// COOLDOWN_FRAMES, so that the next change is not judged on the frames measured before the resize.
+class RenderScale {
+public:
+    static const int SCALE_STEPS = 20;
+    static const int COOLDOWN_FRAMES = 30;
+
+    bool m_enabled = true;
+    float m_targetMs = 16.6f;
+    float m_minScale = 0.5f;
+    float m_maxScale = 1.0f;
+    float m_upperMargin = 0.05f;
+    float m_lowerMargin = 0.15f; // Wider, a higher scale has to be affordable with some margin
+
+    float m_scale = 1.0f;
+    float m_smoothedMs = 0.0f;
+
+    GLuint m_buffer {};
+    GLuint m_color {};
+    int m_width {};
+    int m_height {};
+
+private:
+    int m_cooldown = 0;
+
+public:
+    RenderScale() = default;
+
+    ~RenderScale() {
+        release();
+    }
+
+    // Feeds the duration of the last frame
+    void update(float frameMs) {
+        if (!m_enabled) {
+            m_scale = 1.0f;
+            return;
+        }
+
+        m_smoothedMs = m_smoothedMs > 0.0f ? glm::mix(m_smoothedMs, frameMs, 0.1f) : frameMs;
+        if (m_cooldown > 0) {
+            m_cooldown--;
+            return;
+        }
+
+        // The cost of the passes is roughly proportional to the number of pixels, the square of the scale.
+        // A single change is limited to 10%, the frame time includes work that does not scale.
+        float step = 1.0f / SCALE_STEPS;
+        float desired = m_scale * glm::clamp(std::sqrt(m_targetMs / m_smoothedMs), 0.9f, 1.1f);
+
+        float scale = m_scale;
+        if (m_smoothedMs > m_targetMs * (1.0f + m_upperMargin)) {
+            scale = glm::min(std::floor(desired / step) * step, m_scale - step);
+        } else if (m_smoothedMs < m_targetMs * (1.0f - m_lowerMargin)) {
+            scale = glm::max(std::ceil(desired / step) * step, m_scale + step);
+        }
+        scale = glm::clamp(scale, m_minScale, m_maxScale);
+
+        if (scale != m_scale) {
+            m_scale = scale;
+            m_cooldown = COOLDOWN_FRAMES;
+        }
+    }
+
+    // Render resolution for an output of the given size, and (re)creates m_buffer at that size
+    void resize(int outputWidth, int outputHeight, int &width, int &height) {
+        width = glm::max(static_cast<int>(outputWidth * m_scale + 0.5f), 1);
+        height = glm::max(static_cast<int>(outputHeight * m_scale + 0.5f), 1);
+        if (m_buffer && width == m_width && height == m_height) return;
+
+        release();
+        m_width = width;
+        m_height = height;
+
+        glGenFramebuffers(1, &m_buffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, m_buffer);
+
+        glGenTextures(1, &m_color);
+        glBindTexture(GL_TEXTURE_2D, m_color);
+        glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, m_width, m_height);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, m_color, 0);
+
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "Render scale framebuffer not complete!" << std::endl;
+
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    // Upscales m_buffer to the default framebuffer
+    void blit(int outputWidth, int outputHeight) const {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, m_buffer);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+        glBlitFramebuffer(0, 0, m_width, m_height, 0, 0, outputWidth, outputHeight, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    // Widgets only, drawn in the window of the caller
+    void renderUI() {
+        ImGui::Checkbox("Dynamic resolution", &m_enabled);
+        ImGui::SliderFloat("Target frame time (ms)", &m_targetMs, 4.0f, 50.0f);
+        ImGui::SliderFloat("Min scale", &m_minScale, 0.25f, 1.0f);
+        ImGui::Text("Render scale: %.2f (%d x %d)", m_scale, m_width, m_height);
+    }
+
+    void release() {
+        if (m_buffer) glDeleteFramebuffers(1, &m_buffer);
+        if (m_color) glDeleteTextures(1, &m_color);
+        m_buffer = m_color = 0;
+    }
+};
+
+#endif // RENDER_SCALE_HPP
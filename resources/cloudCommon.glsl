@@ -0,0 +1,440 @@
+// Shared by the cloud pass and the lighting pass: uniform blocks, volume textures, and the raymarching functions.
+// Included after the #version line.
+
+#include "sceneBlocks.glsl"
+
+#define PI 3.1415926535897932384626433832795
+
+// Specialization: the variants of the program (see ShaderVariants) define VARIANT and the constants below,
+// from the volume parameters and the light types of the scene. The generic program reads the uniforms instead.
+#ifndef VARIANT
+#define NUM_LIGHT_STEPS MAX_LIGHT_STEPS    // Upper bound of the light march loop
+#define SCATTERING_OCTAVES u_scatteringOctaves
+#define ADAPTIVE_STEPS u_adaptiveSteps
+#define VOLUME_LOD u_volumeLod
+#define HAS_AMBIENT_LIGHTS true            // The scene may contain lights of this type
+#define HAS_POINT_LIGHTS true
+#define HAS_DIRECTIONAL_LIGHTS true
+#endif
+
+// Light types, constant when the scene has a single one, and false for the types the scene has none of
+bool isAmbient(Light light) {
+	return HAS_AMBIENT_LIGHTS && ((!HAS_POINT_LIGHTS && !HAS_DIRECTIONAL_LIGHTS) || light.type == 0);
+}
+bool isPoint(Light light) {
+	return HAS_POINT_LIGHTS && ((!HAS_AMBIENT_LIGHTS && !HAS_DIRECTIONAL_LIGHTS) || light.type == 1);
+}
+bool isDirectional(Light light) {
+	return HAS_DIRECTIONAL_LIGHTS && ((!HAS_AMBIENT_LIGHTS && !HAS_POINT_LIGHTS) || light.type == 2);
+}
+
+// Lights reaching each screen tile, built by lightCulling.glsl: per tile, the number of lights then their indices
+layout(std430, binding = 0) readonly buffer TileLightsBlock {
+	uint u_tileLights[];
+};
+uniform ivec2 u_lightTileCount;
+uniform vec2 u_lightTileScale; // Screen coordinates to tile coordinates
+
+int g_lightTile = 0; // Offset of the tile of the current pixel in u_tileLights, set by selectLightTile()
+
+void selectLightTile(vec2 texCoords) {
+	ivec2 tile = clamp(ivec2(texCoords * u_lightTileScale), ivec2(0), u_lightTileCount - 1);
+	g_lightTile = (tile.y * u_lightTileCount.x + tile.x) * (MAX_LIGHTS_PER_TILE + 1);
+}
+
+int numTileLights() {
+	return int(u_tileLights[g_lightTile]);
+}
+
+Light tileLight(int i) {
+	return u_lights[u_tileLights[g_lightTile + 1 + i]];
+}
+
+// Smooth falloff of a point light to 0 at its radius
+float lightAttenuation(vec3 p, Light light) {
+	if(!isPoint(light)) return 1.0;
+
+	float ratio = length(light.position - p) / max(light.radius, 1e-4);
+	float window = clamp(1.0 - ratio * ratio * ratio * ratio, 0.0, 1.0);
+	return window * window;
+}
+
+layout(std140) uniform VolumeBlock {
+	int MAX_STEPS;
+	int MAX_LIGHT_STEPS;
+	float u_stepSize;
+	float u_lightStepSize;
+
+	float u_cloudAbsorption;
+	float u_lightAbsorption;
+	float u_densityMultiplier;
+	float u_scatteringG;
+
+	vec4 u_phaseParams;
+
+	vec3 u_domainCenter;
+	bool u_adaptiveSteps;
+	vec3 u_domainSize;
+	float u_stepDistanceGrowth; // Relative growth of the step size per world unit from the camera
+
+	int u_scatteringOctaves;    // 1 = single scattering only
+	float u_octaveAttenuation;  // Per octave scale of the extinction toward the light
+	float u_octaveContribution; // Per octave scale of the scattered energy
+	float u_octaveEccentricity; // Per octave scale of the phase function asymmetry
+
+	bool u_volumeLod;   // Sample the mip levels of the density volume by footprint
+	float u_coneSpread; // Growth of the footprint of the light samples per world unit toward the light
+};
+
+uniform sampler3D u_voxelTexture;
+uniform sampler3D u_voxelTextureNext; // Next keyframe, when the animation is interpolated
+uniform float u_keyframeBlend;        // 0 when there is no interpolation
+
+uniform sampler3D u_occupancy;     // Max-density grid of u_voxelTexture, one cell per brick, with a mip chain
+uniform sampler3D u_occupancyNext; // Same for u_voxelTextureNext
+uniform int u_occupancyLevels;     // Levels used for empty-space skipping, 0 to disable it
+
+#define MAX_SKIPS 64 // Empty cells a ray can jump over, on top of MAX_STEPS
+
+uniform sampler3D u_transmittance;     // Optical depth toward the directional lights, one per channel, from the raw density
+uniform sampler3D u_transmittanceNext; // Same for u_voxelTextureNext
+uniform bool u_useTransmittance;
+
+uniform sampler2D u_cloudShadow;     // Optical depth through the whole volume from the bottom plane of the domain, same channels
+uniform sampler2D u_cloudShadowNext; // Same for u_voxelTextureNext
+
+#define SKY_DISTANCE 1000000.0 // Ray length when there is no opaque surface
+
+uniform float u_pixelSpread; // Footprint of a pixel per world unit from the camera, 0 outside of the cloud pass
+
+#define STEP_LOD_SCALE 0.25 // Share of a view step a density sample stands for, the rest is covered by the jitter
+#define LIGHT_STEP_GROWTH 1.3 // Ratio between consecutive light steps
+
+// Adaptive steps: coarse steps in the empty space, fine ones from the last empty sample before density,
+// back to coarse after a few empty samples. The steps also grow with the opacity already accumulated.
+#define COARSE_STEP_FACTOR 4.0
+#define EMPTY_SAMPLES_BEFORE_COARSE 4
+#define OPACITY_STEP_GROWTH 2.0
+
+void swap(inout float a, inout float b) { // Utility function
+	float tmp = a;
+	a = b;
+	b = tmp;
+}
+
+// Returns true if the ray intersects the domain, and sets tmin and tmax to the two intersection points
+bool projectToDomain(vec3 ro, vec3 rd, out float tmin, out float tmax) { 
+	float dminx = u_domainCenter.x - u_domainSize.x;
+	float dmaxx = u_domainCenter.x + u_domainSize.x;
+	float dminy = u_domainCenter.y - u_domainSize.y;
+	float dmaxy = u_domainCenter.y + u_domainSize.y;
+	float dminz = u_domainCenter.z - u_domainSize.z;
+	float dmaxz = u_domainCenter.z + u_domainSize.z;
+	
+	tmin = (dminx - ro.x) / rd.x;
+	tmax = (dmaxx - ro.x) / rd.x;
+	if (tmin > tmax) swap(tmin, tmax);
+
+	float tymin = (dminy - ro.y) / rd.y;
+	float tymax = (dmaxy - ro.y) / rd.y;
+	if (tymin > tymax) swap(tymin, tymax);
+	if ((tmin > tymax) || (tymin > tmax)) 
+        return false; 
+	if (tymin > tmin)
+		tmin = tymin;
+	if (tymax < tmax)
+		tmax = tymax;
+
+	float tzmin = (dminz - ro.z) / rd.z;
+	float tzmax = (dmaxz - ro.z) / rd.z;
+	if (tzmin > tzmax) swap(tzmin, tzmax);
+
+	if ((tmin > tzmax) || (tzmin > tmax)) 
+		return false;
+	if (tzmin > tmin)
+		tmin = tzmin;
+	if (tzmax < tmax)
+		tmax = tzmax;
+	
+	tmin = max(tmin, 0.0f);
+	tmax = max(tmax, 0.0f);
+	if(tmin >= tmax) return false;
+
+	return true;
+}
+
+// Mip level of the density volume for a sample covering footprint world units
+float densityLod(float footprint) {
+	if(!VOLUME_LOD) return 0.0;
+
+	vec3 voxelSize = 2.0 * u_domainSize / vec3(textureSize(u_voxelTexture, 0));
+	return max(log2(footprint / min(voxelSize.x, min(voxelSize.y, voxelSize.z))), 0.0);
+}
+
+// Explicit LOD: the implicit derivatives are undefined in the divergent raymarching loops
+float sampleDensity(vec3 p, float lod) {
+	// Coordinates in domain space
+	vec3 pDomain = (p - u_domainCenter) / u_domainSize * 0.5 + 0.5;
+
+	if(pDomain.x < -0.01 || pDomain.x > 1.01 || pDomain.y < -0.01 || pDomain.y > 1.01 || pDomain.z < -0.01 || pDomain.z > 1.01)
+		return 0.0;
+
+	float density = textureLod(u_voxelTexture, pDomain, lod).r;
+	if(u_keyframeBlend > 0.0) density = mix(density, textureLod(u_voxelTextureNext, pDomain, lod).r, u_keyframeBlend);
+
+	return density * u_densityMultiplier;
+}
+
+// Distance along the ray to the exit of the largest empty occupancy cell containing p, or 0 if there may be density at p.
+// Starts from the coarsest level, so that large empty regions are crossed in a single jump.
+float emptySpaceSkip(vec3 p, vec3 rayDir) {
+	vec3 pDomain = (p - u_domainCenter) / u_domainSize * 0.5 + 0.5;
+
+	// Keeps the sign, but avoids dividing by 0
+	vec3 side = step(0.0, rayDir);
+	vec3 dir = mix(mix(vec3(-1e-6), vec3(1e-6), side), rayDir, step(1e-6, abs(rayDir)));
+
+	for(int level = u_occupancyLevels - 1; level >= 0; level--) {
+		ivec3 size = textureSize(u_occupancy, level);
+		ivec3 cell = clamp(ivec3(floor(pDomain * vec3(size))), ivec3(0), size - 1);
+
+		float occupancy = texelFetch(u_occupancy, cell, level).r;
+		if(u_keyframeBlend > 0.0) occupancy = max(occupancy, texelFetch(u_occupancyNext, cell, level).r);
+		if(occupancy > 0.0) continue;
+
+		// Exit of the cell, in world space
+		vec3 exitDomain = (vec3(cell) + side) / vec3(size);
+		vec3 exitPoint = (exitDomain - 0.5) * 2.0 * u_domainSize + u_domainCenter;
+		vec3 tExit = (exitPoint - p) / dir;
+
+		return max(min(tExit.x, min(tExit.y, tExit.z)), 0.0);
+	}
+
+	return 0.0;
+}
+
+float hg(float cosTheta, float g) { // Henyey-Greenstein phase function
+	float g2 = g * g;
+	return (1.0 - g2) / pow(1.0 + g2 - 2.0 * g * cosTheta, 1.5) / (4.0 * PI);
+}
+
+float phase(float cosTheta, float gScale) { // Composite phase function, with its asymmetry scaled by gScale
+	float blend = .5;
+	float hgBlend = hg(cosTheta, u_phaseParams.x * gScale) * (1-blend) + hg(cosTheta, -u_phaseParams.y * gScale) * blend;
+	return u_phaseParams.z + hgBlend*u_phaseParams.w;
+}
+
+// Direction from p toward the light. Ambient lights have none, and return 0.
+vec3 lightDirection(vec3 p, Light light) {
+	if(isAmbient(light)) return vec3(0.0);
+	return isDirectional(light) ? normalize(light.position) : normalize(light.position - p);
+}
+
+// Transmittance toward the light with numSteps samples. footprint is the size of the sample at ro, in world units.
+// With the volume LOD, the samples follow a cone widening toward the light: the steps grow geometrically,
+// and each sample reads the mip level of the width of the cone.
+float lightMarch(vec3 ro, Light light, int numSteps, float footprint) {
+	if(isAmbient(light)) return 1.0;
+	vec3 lightDir = lightDirection(ro, light);
+
+	float tmin, tmax;
+	if(!projectToDomain(ro, lightDir, tmin, tmax)) return 1.0;
+
+	float t = tmin;
+
+	if(isPoint(light)) {
+		float tmaxlight = length(light.position - ro);
+		tmax = min(tmax, tmaxlight);
+
+		if(tmin >= tmax) return 1.0;
+	}
+	float maxT = tmax - tmin + 0.01;
+
+	float stepSize = max(maxT / numSteps, u_lightStepSize);
+	float growth = 1.0;
+	if(VOLUME_LOD) { // Same total length
+		growth = LIGHT_STEP_GROWTH;
+		stepSize = max(maxT * (growth - 1.0) / (pow(growth, float(numSteps)) - 1.0), u_lightStepSize);
+	}
+	
+	float totalDensity = 0.0;
+
+	// Constant bound in the variants, so that the loop can be unrolled
+	for(int i = 0; i < NUM_LIGHT_STEPS; i++) {
+		if(i >= numSteps || t > tmax) break;
+
+		vec3 p = ro + lightDir * t;
+		float d = sampleDensity(p, densityLod(footprint + (t - tmin) * u_coneSpread));
+		totalDensity += d * stepSize;
+		t += stepSize;
+		stepSize *= growth;
+	}
+
+	return exp(-totalDensity * u_lightAbsorption);
+}
+
+// Transmittance from p to the light, from the baked volume when the light has a channel in it, else with numSteps samples
+float lightTransmittance(vec3 p, Light light, int numSteps, float footprint) {
+	if(!u_useTransmittance || light.transmittanceChannel < 0) return lightMarch(p, light, numSteps, footprint);
+
+	vec3 pDomain = (p - u_domainCenter) / u_domainSize * 0.5 + 0.5;
+	float depth = texture(u_transmittance, pDomain)[light.transmittanceChannel];
+	if(u_keyframeBlend > 0.0) depth = mix(depth, texture(u_transmittanceNext, pDomain)[light.transmittanceChannel], u_keyframeBlend);
+
+	return exp(-depth * u_densityMultiplier * u_lightAbsorption);
+}
+
+// Transmittance from an opaque surface to the light: the cloud shadow map below the domain, the transmittance volume inside it
+float surfaceTransmittance(vec3 p, Light light) {
+	if(!u_useTransmittance || light.transmittanceChannel < 0) return lightMarch(p, light, MAX_LIGHT_STEPS, 0.0);
+
+	vec3 domainMin = u_domainCenter - u_domainSize;
+	vec3 domainMax = u_domainCenter + u_domainSize;
+
+	if(p.y < domainMin.y) {
+		vec3 lightDir = normalize(light.position);
+		if(lightDir.y <= 0.0) return 1.0; // Below the horizon, the light cannot go through the clouds
+
+		// Where the ray toward the light crosses the bottom plane
+		vec3 q = p + lightDir * (domainMin.y - p.y) / lightDir.y;
+		vec2 uv = (q.xz - domainMin.xz) / (domainMax.xz - domainMin.xz);
+
+		float depth = texture(u_cloudShadow, uv)[light.transmittanceChannel];
+		if(u_keyframeBlend > 0.0) depth = mix(depth, texture(u_cloudShadowNext, uv)[light.transmittanceChannel], u_keyframeBlend);
+
+		return exp(-depth * u_densityMultiplier * u_lightAbsorption);
+	}
+
+	if(all(lessThanEqual(p, domainMax)) && all(greaterThanEqual(p, domainMin))) return lightTransmittance(p, light, MAX_LIGHT_STEPS, 0.0);
+
+	return lightMarch(p, light, MAX_LIGHT_STEPS, 0.0); // Beside or above the domain
+}
+
+vec3 getSkyColor(vec3 dir) {
+	vec3 color = vec3(0.2, 0.4, 0.6) * (1.0 - dir.y) + vec3(0.8, 0.9, 1.0) * dir.y;
+
+	// Directionnal lights
+	for(int i=0; i<numTileLights(); i++) {
+		Light light = tileLight(i);
+		if(!isDirectional(light)) continue;
+		float lightEnergy = pow(max(dot(dir, normalize(light.position)), 0.), 256.);
+		color += lightEnergy * light.intensity * light.color;
+	}
+
+	return max(color, 0.);
+}
+
+// Light scattered toward the eye per unit of density, from a light reaching the sample with lightTransmittance.
+// The octaves after the first approximate multiple scattering (Wrenninge et al., Oz: The Great and Volumetric):
+// each one sees a lower extinction toward the light, contributes less, and scatters more uniformly.
+float inScattering(float lightTransmittance, float cosTheta) {
+	float scattering = 0.0;
+	float attenuation = 1.0;
+	float contribution = 1.0;
+	float eccentricity = 1.0;
+
+	for(int i = 0; i < SCATTERING_OCTAVES; i++) {
+		scattering += contribution * pow(lightTransmittance, attenuation) * phase(cosTheta, eccentricity);
+		attenuation *= u_octaveAttenuation;
+		contribution *= u_octaveContribution;
+		eccentricity *= u_octaveEccentricity;
+	}
+
+	return scattering;
+}
+
+// Light energy and transmittance along the ray, up to trender. The first sample is offset by jitter steps, in [0, 1).
+// budget scales MAX_STEPS and MAX_LIGHT_STEPS, in ]0, 1].
+// cloudDepth is the mean distance of the cloud along the ray, weighted by its opacity, or trender if the ray crossed no cloud
+vec4 raymarchCloud(vec3 rayOrigin, vec3 rayDir, float trender, float jitter, float budget, out float cloudDepth) {
+	int maxSteps = max(int(float(MAX_STEPS) * budget), 1);
+	int maxLightSteps = max(int(float(MAX_LIGHT_STEPS) * budget), 1);
+
+	float transmittance = 1.0;
+	vec3 lightEnergy = vec3(0);
+	float weightedDepth = 0.0;
+
+	float tmin, tmax;
+	if(projectToDomain(rayOrigin, rayDir, tmin, tmax)) {
+		tmax = min(tmax, trender);
+		float baseStepSize = max((tmax - tmin) / maxSteps, u_stepSize);
+		float t = tmin + jitter * baseStepSize;
+		float prevT = tmin;
+		bool coarse = ADAPTIVE_STEPS;
+		int emptySamples = 0;
+		int skips = 0;
+		for(int i = 0; i < maxSteps && t < tmax; i++) {
+			vec3 p = rayOrigin + rayDir * t;
+
+			// Empty cells are crossed without spending a step
+			float skip = skips < MAX_SKIPS ? emptySpaceSkip(p, rayDir) : 0.0;
+			if(skip > 0.0) {
+				prevT = t + skip;
+				t += skip + baseStepSize * 0.01;
+				skips++;
+				i--;
+				continue;
+			}
+
+			float stepSize = baseStepSize;
+			if(ADAPTIVE_STEPS) stepSize *= (1.0 + t * u_stepDistanceGrowth) * (1.0 + (1.0 - transmittance) * OPACITY_STEP_GROWTH);
+
+			// Level of detail from the width of the pixel at that distance, and from the length of the step
+			float footprint = max(t * u_pixelSpread, stepSize * STEP_LOD_SCALE);
+			float density = sampleDensity(p, densityLod(footprint));
+
+			if(coarse && density > 0) {
+				coarse = false;
+				emptySamples = 0;
+
+				// Back up to the last empty sample, and enter the density with fine steps
+				float refinedT = prevT + stepSize;
+				if(refinedT < t) {
+					t = refinedT;
+					continue;
+				}
+			}
+
+			if(density > 0) {
+				emptySamples = 0;
+
+				vec3 scattered = vec3(0);
+				for(int j = 0; j < numTileLights(); j++) {
+					Light light = tileLight(j);
+					float lightTransmittance = lightTransmittance(p, light, maxLightSteps, footprint) * lightAttenuation(p, light);
+					// Angle between the view ray and the light, the phase function peaks when looking toward the light
+					float cosTheta = dot(rayDir, lightDirection(p, light));
+					scattered += inScattering(lightTransmittance, cosTheta) * light.intensity * light.color;
+				}
+				scattered *= density;
+
+				// In-scattering integrated analytically over the segment, as the transmittance decreases along it
+				// (Hillaire 2015), instead of a Riemann sum that overshoots with large steps
+				float extinction = density * u_cloudAbsorption;
+				float stepTransmittance = exp(-extinction * stepSize);
+				vec3 integrated = extinction > 1e-5 ? scattered * (1.0 - stepTransmittance) / extinction : scattered * stepSize;
+				lightEnergy += transmittance * integrated;
+				weightedDepth += t * transmittance * (1.0 - stepTransmittance);
+				transmittance *= stepTransmittance;
+
+				if(transmittance < 0.01) break;
+			} else if(ADAPTIVE_STEPS && ++emptySamples >= EMPTY_SAMPLES_BEFORE_COARSE) {
+				coarse = true;
+			}
+
+			prevT = t;
+			t += coarse ? stepSize * COARSE_STEP_FACTOR : stepSize;
+		}
+	}
+
+	cloudDepth = transmittance < 0.999 ? weightedDepth / (1.0 - transmittance) : trender;
+
+	return vec4(lightEnergy, transmittance);
+}
+
+// Direction of the primary ray through a point of the screen
+vec3 primaryRayDir(vec2 texCoords) {
+	vec4 clip = vec4(texCoords * 2.0 - 1.0, -1.0, 1.0);
+	vec4 eye = vec4(vec2(u_invProjMat * clip), -1.0, 0.0);
+	return normalize(vec3(u_invViewMat * eye));
+}
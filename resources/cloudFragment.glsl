@@ -0,0 +1,111 @@
+#version 430 core
+layout(location = 0) out vec4 CloudColor;     // Light energy, transmittance
+layout(location = 1) out vec2 CloudDistance;  // Distance the ray was marched to, to guide the upsampling, and depth of the cloud
+
+in vec2 TexCoords;
+
+uniform sampler2D u_Depth;
+
+#include "cloudCommon.glsl"
+
+// Previous frame of the cloud pass, see CloudHistory
+uniform sampler2D u_historyCloud;
+uniform sampler2D u_historyDistance;
+uniform bool u_historyValid;
+uniform mat4 u_prevProjViewMat;
+uniform vec3 u_prevCameraPosition;
+
+uniform int u_updateInterval; // 1, 4 or 16 pixels per block
+uniform int u_updateIndex;    // Pixel of each block raymarched this frame
+
+uniform sampler2D u_blueNoise;
+uniform bool u_jitterRays;
+uniform int u_frameIndex;
+uniform float u_historyWeight; // Weight of the history in the exponential moving average of the raymarched pixels, 0 = no accumulation
+
+uniform sampler2D u_tileBudget; // Per-tile statistics of the previous frame, see TileStatistics
+uniform int u_tileSize;
+
+#define GOLDEN_RATIO_CONJUGATE 0.61803398875
+
+#define DISOCCLUSION_THRESHOLD 0.05
+
+// Order of the pixels of 2x2 and 4x4 blocks
+int bayer2(ivec2 p) {
+	return ((p.y & 1) * 3) ^ ((p.x & 1) * 2);
+}
+
+int bayerIndex(ivec2 p) {
+	if(u_updateInterval == 4) return bayer2(p);
+	return bayer2(p) * 4 + bayer2(p >> 1);
+}
+
+vec2 projectToPreviousFrame(vec3 p) {
+	vec4 clip = u_prevProjViewMat * vec4(p, 1.0);
+	return clip.xy / clip.w * 0.5 + 0.5;
+}
+
+// Offset of the first sample of the ray, in steps: blue noise over the screen, shifted every frame by the golden ratio
+// so that the offsets of a pixel are well distributed over time as well
+float rayJitter() {
+	if(!u_jitterRays) return 0.0;
+
+	ivec2 texel = ivec2(gl_FragCoord.xy) % textureSize(u_blueNoise, 0);
+	return fract(texelFetch(u_blueNoise, texel, 0).r + float(u_frameIndex) * GOLDEN_RATIO_CONJUGATE);
+}
+
+// Reprojects the history, returns false on disocclusion or when the pixel was outside of the previous frame
+bool reproject(vec3 rayOrigin, vec3 rayDir, vec3 position, float trender, out vec4 cloud, out vec2 distances) {
+	// The depth of the cloud is only known in the history: its value at the same pixel is a first guess,
+	// refined by a second lookup where that guess reprojects
+	float cloudDepth = texture(u_historyDistance, TexCoords).g;
+	vec2 prevCoords = projectToPreviousFrame(rayOrigin + rayDir * cloudDepth);
+	if(any(lessThan(prevCoords, vec2(0.0))) || any(greaterThan(prevCoords, vec2(1.0)))) return false;
+
+	cloudDepth = texture(u_historyDistance, prevCoords).g;
+	prevCoords = projectToPreviousFrame(rayOrigin + rayDir * cloudDepth);
+	if(any(lessThan(prevCoords, vec2(0.0))) || any(greaterThan(prevCoords, vec2(1.0)))) return false;
+
+	distances = texture(u_historyDistance, prevCoords).rg;
+
+	// The previous frame saw another surface there
+	float prevDistance = trender < SKY_DISTANCE ? length(position - u_prevCameraPosition) : SKY_DISTANCE;
+	if(abs(distances.r - prevDistance) > DISOCCLUSION_THRESHOLD * prevDistance) return false;
+
+	cloud = texture(u_historyCloud, prevCoords);
+	distances = vec2(trender, min(distances.g, trender));
+	return true;
+}
+
+// Cloud pass, rendered at a fraction of the resolution of the G-buffer and upsampled by the lighting pass
+void main() {
+	selectLightTile(TexCoords);
+
+	float depth = texture(u_Depth, TexCoords).r;
+	vec3 position = reconstructPosition(TexCoords, depth);
+
+	vec3 rayDir = primaryRayDir(TexCoords);
+	vec3 rayOrigin = u_invViewMat[3].xyz;
+
+	float trender = length(position - rayOrigin);
+	if(isSky(depth)) trender = SKY_DISTANCE;
+
+	vec4 history;
+	vec2 historyDistances;
+	bool reprojected = u_historyValid && reproject(rayOrigin, rayDir, position, trender, history, historyDistances);
+
+	bool update = !reprojected || u_updateInterval == 1 || bayerIndex(ivec2(gl_FragCoord.xy)) == u_updateIndex;
+	if(!update) {
+		CloudColor = history;
+		CloudDistance = historyDistances;
+		return;
+	}
+
+	float cloudDepth;
+	float budget = texelFetch(u_tileBudget, ivec2(gl_FragCoord.xy) / u_tileSize, 0).a;
+	vec4 cloud = raymarchCloud(rayOrigin, rayDir, trender, rayJitter(), budget, cloudDepth);
+
+	// Accumulate the jittered samples over the frames
+	CloudColor = reprojected ? mix(cloud, history, u_historyWeight) : cloud;
+	CloudDistance = vec2(trender, cloudDepth);
+}
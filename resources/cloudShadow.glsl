@@ -0,0 +1,53 @@
+#version 430
+
+// Top-down cloud shadow map: optical depth from the bottom plane of the domain through the whole volume,
+// toward up to 4 directional lights, one per channel. Integrated from the raw density, like transmittance.glsl.
+// A surface below the domain looks it up where its ray toward the light crosses the bottom plane.
+
+layout (local_size_x = 8, local_size_y = 8) in;
+
+layout (rgba16f, binding = 0) writeonly uniform image2D img_output;
+
+uniform sampler3D u_volume;
+uniform vec3 u_domainSize;   // Half-size of the domain, in world units
+uniform float u_stepSize;    // Integration step, in world units
+uniform vec3 u_lightDirs[4]; // Toward the lights
+uniform int u_numLights;
+
+#define MAX_BAKE_STEPS 256
+
+void main() {
+	ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+	ivec2 size = imageSize(img_output);
+	if(any(greaterThanEqual(texel, size))) return;
+
+	// Point of the bottom plane, relative to the center of the domain
+	vec2 uv = (vec2(texel) + 0.5) / vec2(size);
+	vec3 p = vec3((uv.x - 0.5) * 2.0 * u_domainSize.x, -u_domainSize.y, (uv.y - 0.5) * 2.0 * u_domainSize.z);
+
+	vec4 opticalDepth = vec4(0.0);
+
+	for(int l = 0; l < u_numLights; l++) {
+		vec3 dir = normalize(u_lightDirs[l]);
+		if(dir.y <= 0.0) continue; // The light never crosses the bottom plane upwards
+
+		// Distance to the boundary of the domain along dir, without dividing by 0
+		vec3 side = step(0.0, dir);
+		vec3 safeDir = mix(mix(vec3(-1e-6), vec3(1e-6), side), dir, step(1e-6, abs(dir)));
+		vec3 tExit = ((side * 2.0 - 1.0) * u_domainSize - p) / safeDir;
+		float tmax = max(min(tExit.x, min(tExit.y, tExit.z)), 0.0);
+
+		int numSteps = clamp(int(ceil(tmax / u_stepSize)), 1, MAX_BAKE_STEPS);
+		float stepSize = tmax / float(numSteps);
+
+		float depth = 0.0;
+		for(int i = 0; i < numSteps; i++) {
+			vec3 q = p + dir * (float(i) + 0.5) * stepSize;
+			depth += texture(u_volume, q / (2.0 * u_domainSize) + 0.5).r * stepSize;
+		}
+
+		opticalDepth[l] = depth;
+	}
+
+	imageStore(img_output, texel, opticalDepth);
+}
@@ -2,9 +2,11 @@
 
 layout (local_size_x = 8, local_size_y = 8, local_size_z = 8) in;
 
-layout (r32f, binding = 0) uniform image3D img_output;
+// No format qualifier: the volume can be r32f, r16f or r8, and the store converts to the format of the bound image
+layout (binding = 0) writeonly uniform image3D img_output;
 
 uniform vec3 u_resolution;
+uniform ivec3 u_offset; // First voxel of the dispatch, when the volume is generated in several slabs
 uniform vec3 u_targetSize;
 uniform vec3 u_targetOffset;
 uniform float u_time;
@@ -12,6 +14,10 @@ uniform float u_time;
 uniform vec3 u_windDir;
 uniform float u_windSpeed;
 
+uniform bool u_useNoiseTextures; // Sample the baked noises instead of evaluating simplex noise
+uniform sampler3D u_baseNoise;
+uniform sampler3D u_detailNoise;
+
 
 vec4 permute(vec4 x){return mod(((x*34.0)+1.0)*x, 289.0);}
 vec4 taylorInvSqrt(vec4 r){return 1.79284291400159 - 0.85373472095314 * r;}
@@ -100,14 +106,26 @@ float fbm(vec3 pos, int octaves)  {
 }
 
 void main() {
-	ivec3 coords = ivec3(gl_GlobalInvocationID);
+	ivec3 coords = ivec3(gl_GlobalInvocationID) + u_offset;
 	vec3 nPos = (vec3(coords) / vec3(u_resolution) * 2.0 - 1.0) * u_targetSize + u_targetOffset;
 	
 	vec3 windDir = vec3(0.0, 0.0, 1.0);
 	float windSpeed = 10;
 
+	vec3 coveragePos = nPos + windDir * windSpeed * u_time;
+	vec3 detailsPos = nPos + windDir * windSpeed * u_time * 1.5;
+
 	vec3 coverageSizing = vec3(0.01, 0.0, 0.01);
-	float cloudCoverage = fbm(vec3(nPos + windDir * windSpeed * u_time) * coverageSizing, 2) * 0.5 + 0.2;
+	vec3 detailsSizing = vec3(0.1, 0.2, 0.1) * 0.5;
+
+	float cloudCoverage;
+	if(u_useNoiseTextures) {
+		// The baked noises have 4 cells per tile, so the sizing is divided by 4 to keep the same feature size
+		float coverageNoise = textureLod(u_baseNoise, coveragePos * coverageSizing * 0.25, 0.0).r;
+		cloudCoverage = (coverageNoise * 2.0 - 1.0) * 0.85 + 0.2;
+	} else {
+		cloudCoverage = fbm(coveragePos * coverageSizing, 2) * 0.5 + 0.2;
+	}
 	cloudCoverage = max(cloudCoverage, 0.0);
 	
 	float normalizedHeight = (coords.y / u_resolution.y) * 2.0 - 1.0;
@@ -115,10 +133,14 @@ void main() {
 	
 	cloudCoverage *= heightFactor;
 	
-	vec3 detailsSizing = vec3(0.1, 0.2, 0.1) * 0.5;
-	
 	if(cloudCoverage > 0.0) {
-		float details = (fbm(vec3(nPos + windDir * windSpeed * u_time * 1.5) * detailsSizing, 4) * 0.5 + 0.5) * 0.8;
+		float details;
+		if(u_useNoiseTextures) {
+			vec3 detailNoise = textureLod(u_detailNoise, detailsPos * detailsSizing * 0.25, 0.0).rgb;
+			details = dot(detailNoise, vec3(0.625, 0.25, 0.125)) * 0.8;
+		} else {
+			details = (fbm(detailsPos * detailsSizing, 4) * 0.5 + 0.5) * 0.8;
+		}
 		cloudCoverage -= details * 0.4;// * cloudCoverage;
 	}
 
@@ -1,18 +1,23 @@
 #version 330 core
 
-layout (location = 0) out vec3 gPosition;
-layout (location = 1) out vec3 gNormal;
-layout (location = 2) out vec3 gAlbedo;
+// Slim G-buffer: the position is reconstructed from the depth buffer
+layout (location = 0) out vec2 gNormal; // Octahedral encoding, in [0, 1]
+layout (location = 1) out vec4 gAlbedo;
 
 // Input from the vertex shaders
 in vec3 vertexNormal;
 in vec3 worldPos;
 in vec2 textureUV;
 
-uniform vec3 u_cameraPosition;
+// Maps the unit sphere onto the [0, 1] square, the lower hemisphere folded onto the corners
+vec2 encodeNormal(vec3 n) {
+	n /= abs(n.x) + abs(n.y) + abs(n.z);
+	vec2 signs = vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+	vec2 folded = n.z >= 0.0 ? n.xy : (1.0 - abs(n.yx)) * signs;
+	return folded * 0.5 + 0.5;
+}
 
 void main() {
-	gPosition = worldPos;
-	gNormal = vertexNormal;
-	gAlbedo = vec3(1);
+	gNormal = encodeNormal(normalize(vertexNormal));
+	gAlbedo = vec4(1);
 }
\ No newline at end of file
@@ -9,8 +9,16 @@ layout(location=0) in vec3 vPosition;
 layout(location=1) in vec3 vNormal;
 layout(location=2) in vec2 vUV;
 
-uniform mat4 u_viewMat, u_projMat, u_modelMat;
-uniform mat4 u_proj_viewMat;
+layout(std140) uniform CameraBlock {
+	mat4 u_viewMat;
+	mat4 u_projMat;
+	mat4 u_invViewMat;
+	mat4 u_invProjMat;
+	mat4 u_proj_viewMat;
+	vec4 u_cameraPosition;
+};
+
+uniform mat4 u_modelMat;
 uniform mat4 u_transposeInverseModelMat;
 
 out vec3 vertexNormal;
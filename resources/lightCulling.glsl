@@ -0,0 +1,121 @@
+#version 430
+
+// Tiled light culling: one work group per screen tile of the G-buffer. Point lights are kept if their sphere crosses
+// the frustum of the tile, up to the farthest opaque surface in it: any ray of the tile, shading a surface or
+// marching the clouds up to that surface, can only meet those. Ambient and directional lights reach every tile.
+// The list of a tile holds the ambient and directional lights first, then the point lights, each by increasing index:
+// a tile over MAX_LIGHTS_PER_TILE always drops the same point lights, the last ones, and never the global lights.
+
+#define LIGHT_TILE_SIZE 16 // Must match LightCulling::TILE_SIZE
+
+layout (local_size_x = LIGHT_TILE_SIZE, local_size_y = LIGHT_TILE_SIZE) in;
+
+#include "sceneBlocks.glsl"
+
+layout(std430, binding = 0) writeonly buffer TileLightsBlock {
+	uint u_tileLights[];
+};
+
+// Read back by LightCulling for the UI
+layout(std430, binding = 1) buffer CullingStatsBlock {
+	uint u_overflowTiles; // Tiles with more lights than MAX_LIGHTS_PER_TILE
+	uint u_maxTileLights; // Lights of the most crowded tile, dropped ones included
+};
+
+uniform sampler2D u_Depth;
+uniform ivec2 u_lightTileCount;
+
+shared uint s_maxDistance; // Float bits, ordered like the floats as they are positive
+#define LIGHT_MASK_WORDS ((MAX_LIGHTS + 31) / 32)
+shared uint s_globalMask[LIGHT_MASK_WORDS]; // Bit i set if light i is ambient or directional
+shared uint s_pointMask[LIGHT_MASK_WORDS];  // Bit i set if light i is a point light crossing the tile
+
+// World-space direction of the ray through a point of the screen, in [0, 1]^2
+vec3 screenRay(vec2 screen) {
+	vec4 eye = u_invProjMat * vec4(screen * 2.0 - 1.0, -1.0, 1.0);
+	return normalize(mat3(u_invViewMat) * (eye.xyz / eye.w));
+}
+
+void main() {
+	ivec2 tile = ivec2(gl_WorkGroupID.xy);
+	ivec2 pixel = ivec2(gl_GlobalInvocationID.xy);
+	ivec2 size = textureSize(u_Depth, 0);
+	vec3 eye = u_invViewMat[3].xyz;
+
+	if(gl_LocalInvocationIndex == 0) s_maxDistance = 0u;
+	if(gl_LocalInvocationIndex < LIGHT_MASK_WORDS) {
+		s_globalMask[gl_LocalInvocationIndex] = 0u;
+		s_pointMask[gl_LocalInvocationIndex] = 0u;
+	}
+	barrier();
+
+	if(all(lessThan(pixel, size))) {
+		float depth = texelFetch(u_Depth, pixel, 0).r;
+		vec3 position = reconstructPosition((vec2(pixel) + 0.5) / vec2(size), depth);
+		float distance = isSky(depth) ? 3.4e38 : length(position - eye); // The sky is infinitely far
+		atomicMax(s_maxDistance, floatBitsToUint(distance));
+	}
+	barrier();
+
+	// Side planes of the tile frustum, through the eye, with normals pointing inside
+	vec2 tileMin = vec2(tile * LIGHT_TILE_SIZE) / vec2(size);
+	vec2 tileMax = min(vec2((tile + 1) * LIGHT_TILE_SIZE) / vec2(size), vec2(1.0));
+	vec3 corners[4] = vec3[4](
+		screenRay(tileMin),
+		screenRay(vec2(tileMax.x, tileMin.y)),
+		screenRay(tileMax),
+		screenRay(vec2(tileMin.x, tileMax.y))
+	);
+	vec3 planes[4];
+	for(int i = 0; i < 4; i++) planes[i] = normalize(cross(corners[(i + 1) % 4], corners[i]));
+
+	float maxDistance = uintBitsToFloat(s_maxDistance);
+
+	for(int i = int(gl_LocalInvocationIndex); i < u_numLights; i += LIGHT_TILE_SIZE * LIGHT_TILE_SIZE) {
+		Light light = u_lights[i];
+
+		uint bit = 1u << uint(i % 32);
+		if(light.type != 1) {
+			atomicOr(s_globalMask[i / 32], bit);
+			continue;
+		}
+
+		vec3 toLight = light.position - eye;
+		bool visible = length(toLight) - light.radius <= maxDistance;
+		for(int p = 0; p < 4; p++) visible = visible && dot(planes[p], toLight) >= -light.radius;
+
+		if(visible) atomicOr(s_pointMask[i / 32], bit);
+	}
+	barrier();
+
+	// One invocation per mask word writes the lights of its word, after those of the previous words
+	uint offset = uint(tile.y * u_lightTileCount.x + tile.x) * (MAX_LIGHTS_PER_TILE + 1);
+	uint numGlobal = 0u, numPoint = 0u, globalBefore = 0u, pointBefore = 0u;
+	for(uint w = 0u; w < uint(LIGHT_MASK_WORDS); w++) {
+		if(w == gl_LocalInvocationIndex) {
+			globalBefore = numGlobal;
+			pointBefore = numPoint;
+		}
+		numGlobal += uint(bitCount(s_globalMask[w]));
+		numPoint += uint(bitCount(s_pointMask[w]));
+	}
+
+	uint w = gl_LocalInvocationIndex;
+	if(w < uint(LIGHT_MASK_WORDS)) {
+		uint slot = globalBefore;
+		for(uint bits = s_globalMask[w]; bits != 0u && slot < uint(MAX_LIGHTS_PER_TILE); bits &= bits - 1u) {
+			u_tileLights[offset + 1u + slot++] = w * 32u + uint(findLSB(bits));
+		}
+		slot = numGlobal + pointBefore;
+		for(uint bits = s_pointMask[w]; bits != 0u && slot < uint(MAX_LIGHTS_PER_TILE); bits &= bits - 1u) {
+			u_tileLights[offset + 1u + slot++] = w * 32u + uint(findLSB(bits));
+		}
+	}
+
+	if(gl_LocalInvocationIndex == 0) {
+		uint numLights = numGlobal + numPoint;
+		u_tileLights[offset] = min(numLights, uint(MAX_LIGHTS_PER_TILE));
+		if(numLights > uint(MAX_LIGHTS_PER_TILE)) atomicAdd(u_overflowTiles, 1u);
+		atomicMax(u_maxTileLights, numLights);
+	}
+}
@@ -1,246 +1,112 @@
-#version 330 core
+#version 430 core
 out vec4 FragColor;
   
 in vec2 TexCoords;
 
-uniform sampler2D u_Position;
-uniform sampler2D u_Normal;
+uniform sampler2D u_Depth;
+uniform sampler2D u_Normal; // Octahedral encoding
 uniform sampler2D u_Albedo;
 
-uniform mat4 u_viewMat;
-uniform mat4 u_projMat;
-uniform mat4 u_invViewMat;
-uniform mat4 u_invProjMat;
+#include "cloudCommon.glsl"
 
-#define MAX_LIGHTS 50
+uniform sampler2D u_cloud;         // Output of the cloud pass: light energy and transmittance, at a lower resolution
+uniform sampler2D u_cloudDistance; // Distance each texel of the cloud pass was raymarched to
 
-#define PI 3.1415926535897932384626433832795
+#define UPSAMPLE_DEPTH_SHARPNESS 32.0
 
-struct Light {
-	int type; // 0 = ambiant, 1 = point, 2 = directional
-	vec3 position;
-	vec3 color;
-	float intensity;
-};
+// Bilateral upsampling of the cloud pass: the bilinear weights of the 4 nearest cloud texels are reduced
+// when their ray stopped at a different distance than this pixel's, so that clouds do not bleed across silhouettes
+vec4 upsampleClouds(vec2 texCoords, float distance) {
+	ivec2 size = textureSize(u_cloud, 0);
+	vec2 coord = texCoords * vec2(size) - 0.5;
+	vec2 base = floor(coord);
+	vec2 f = coord - base;
 
-uniform Light u_lights[MAX_LIGHTS];
-uniform int u_numLights;
+	vec4 sum = vec4(0.0);
+	float weightSum = 0.0;
+	vec4 closest = vec4(0.0, 0.0, 0.0, 1.0);
+	float closestDiff = SKY_DISTANCE;
 
-uniform vec3 u_domainCenter;
-uniform vec3 u_domainSize;
+	for(int i = 0; i < 4; i++) {
+		ivec2 offset = ivec2(i & 1, i >> 1);
+		ivec2 texel = clamp(ivec2(base) + offset, ivec2(0), size - 1);
 
-uniform float u_cloudAbsorption;
-uniform float u_lightAbsorption;
+		vec4 cloud = texelFetch(u_cloud, texel, 0);
+		float diff = abs(texelFetch(u_cloudDistance, texel, 0).r - distance) / distance;
 
-uniform float u_densityMultiplier;
+		vec2 bilinear = mix(1.0 - f, f, vec2(offset));
+		float weight = bilinear.x * bilinear.y * exp(-diff * UPSAMPLE_DEPTH_SHARPNESS);
+		sum += cloud * weight;
+		weightSum += weight;
 
-uniform float u_scatteringG;
-uniform vec4 u_phaseParams;
-
-uniform int MAX_STEPS;
-uniform int MAX_LIGHT_STEPS;
-
-uniform float u_stepSize;
-uniform float u_lightStepSize;
-
-uniform sampler3D u_voxelTexture;
-
-void swap(inout float a, inout float b) { // Utility function
-	float tmp = a;
-	a = b;
-	b = tmp;
-}
-
-// Returns true if the ray intersects the domain, and sets tmin and tmax to the two intersection points
-bool projectToDomain(vec3 ro, vec3 rd, out float tmin, out float tmax) { 
-	float dminx = u_domainCenter.x - u_domainSize.x;
-	float dmaxx = u_domainCenter.x + u_domainSize.x;
-	float dminy = u_domainCenter.y - u_domainSize.y;
-	float dmaxy = u_domainCenter.y + u_domainSize.y;
-	float dminz = u_domainCenter.z - u_domainSize.z;
-	float dmaxz = u_domainCenter.z + u_domainSize.z;
-	
-	tmin = (dminx - ro.x) / rd.x;
-	tmax = (dmaxx - ro.x) / rd.x;
-	if (tmin > tmax) swap(tmin, tmax);
-
-	float tymin = (dminy - ro.y) / rd.y;
-	float tymax = (dmaxy - ro.y) / rd.y;
-	if (tymin > tymax) swap(tymin, tymax);
-	if ((tmin > tymax) || (tymin > tmax)) 
-        return false; 
-	if (tymin > tmin)
-		tmin = tymin;
-	if (tymax < tmax)
-		tmax = tymax;
-
-	float tzmin = (dminz - ro.z) / rd.z;
-	float tzmax = (dmaxz - ro.z) / rd.z;
-	if (tzmin > tzmax) swap(tzmin, tzmax);
-
-	if ((tmin > tzmax) || (tzmin > tmax)) 
-		return false;
-	if (tzmin > tmin)
-		tmin = tzmin;
-	if (tzmax < tmax)
-		tmax = tzmax;
-	
-	tmin = max(tmin, 0.0f);
-	tmax = max(tmax, 0.0f);
-	if(tmin >= tmax) return false;
-
-	return true;
-}
-
-float sampleDensity(vec3 p) {
-	// Coordinates in domain space
-	vec3 pDomain = (p - u_domainCenter) / u_domainSize * 0.5 + 0.5;
-
-	if(pDomain.x < -0.01 || pDomain.x > 1.01 || pDomain.y < -0.01 || pDomain.y > 1.01 || pDomain.z < -0.01 || pDomain.z > 1.01)
-		return 0.0;
-
-	return texture(u_voxelTexture, pDomain).r * u_densityMultiplier;
-}
-
-float hg(float cosTheta, float g) { // Henyey-Greenstein phase function
-	float g2 = g * g;
-	return (1.0 - g2) / pow(1.0 + g2 - 2.0 * g * cosTheta, 1.5) / (4.0 * PI);
-}
-
-float phase(float cosTheta) { // Composite phase function
-	float blend = .5;
-	float hgBlend = hg(cosTheta, u_phaseParams.x) * (1-blend) + hg(cosTheta, -u_phaseParams.y) * blend;
-	return u_phaseParams.z + hgBlend*u_phaseParams.w;
-}
-
-float lightMarch(vec3 ro, Light light) {
-	vec3 lightDir = normalize(light.position - ro);
-	if(light.type == 2) lightDir = normalize(light.position);
-	if(light.type == 0) return 1.0;
-
-	float tmin, tmax;
-	if(!projectToDomain(ro, lightDir, tmin, tmax)) return 1.0;
-
-	float t = tmin;
-
-	if(light.type == 1) {
-		// Point light
-		float tmaxlight = length(light.position - ro);
-		tmax = min(tmax, tmaxlight);
-
-		if(tmin >= tmax) return 1.0;
-	}
-	float maxT = tmax - tmin + 0.01;
-
-	float stepSize = max(maxT / MAX_LIGHT_STEPS, u_lightStepSize);
-	
-	float totalDensity = 0.0;
-
-	for(int i = 0; i < MAX_LIGHT_STEPS && t <= tmax; i++) {
-		vec3 p = ro + lightDir * t;
-		float d = sampleDensity(p);
-		totalDensity += d * stepSize;
-		t += stepSize;
-	}
-
-	return exp(-totalDensity * u_lightAbsorption);
-}
-
-vec3 getSkyColor(vec3 dir) {
-	vec3 color = vec3(0.2, 0.4, 0.6) * (1.0 - dir.y) + vec3(0.8, 0.9, 1.0) * dir.y;
-
-	// Directionnal lights
-	for(int i=0; i<u_numLights; i++) {
-		if(u_lights[i].type != 2) continue;
-		float lightEnergy = pow(max(dot(dir, normalize(u_lights[i].position)), 0.), 256.);
-		color += lightEnergy * u_lights[i].intensity * u_lights[i].color;
+		if(diff < closestDiff) {
+			closestDiff = diff;
+			closest = cloud;
+		}
 	}
 
-	return max(color, 0.);
+	// None of the texels is at the right depth, e.g. on a thin object: the closest one is the best guess
+	return weightSum > 1e-4 ? sum / weightSum : closest;
 }
 
-vec4 raymarchCloud(vec3 rayOrigin, vec3 rayDir, float trender) {
-	float transmittance = 1.0;
-	vec3 lightEnergy = vec3(0);
-
-	float tmin, tmax;
-	if(projectToDomain(rayOrigin, rayDir, tmin, tmax)) {
-		float t = tmin;
-		tmax = min(tmax, trender);
-		float stepSize = max((tmax - tmin) / MAX_STEPS, u_stepSize);
-		for(int i = 0; i < MAX_STEPS && t < tmax; i++) {
-			vec3 p = rayOrigin + rayDir * t;
-			float density = sampleDensity(p);
-
-			if(density > 0) {
-				for(int j = 0; j < u_numLights; j++) {
-					float lightTransmittance = lightMarch(p, u_lights[j]);
-					float phase = phase(dot(rayDir, rayDir));
-					lightEnergy += density * stepSize * transmittance * lightTransmittance * phase * u_lights[j].intensity * u_lights[j].color;
-				}
-				transmittance *= exp(-density * stepSize * u_cloudAbsorption);
-
-				if(transmittance < 0.01) break;
-			}
-			t += stepSize;
-		}
-	}
-
-	return vec4(lightEnergy, transmittance);
+vec3 decodeNormal(vec2 encoded) {
+	vec2 f = encoded * 2.0 - 1.0;
+	vec3 n = vec3(f, 1.0 - abs(f.x) - abs(f.y));
+	float t = clamp(-n.z, 0.0, 1.0);
+	n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+	return normalize(n);
 }
 
 vec3 computeRenderColor(vec3 albedo, vec3 normal, vec3 position) { // Lighting on solid objects
 	vec3 diffuse = vec3(0);
 	vec3 ambient = vec3(0);
 
-	for (int i = 0; i < u_numLights; i++) {
-		if(u_lights[i].type == 0) {
-			ambient += albedo * u_lights[i].color * u_lights[i].intensity;
+	for (int i = 0; i < numTileLights(); i++) {
+		Light light = tileLight(i);
+		if(isAmbient(light)) {
+			ambient += albedo * light.color * light.intensity;
 			continue;
 		}
 		vec3 lightDir;
-		if(u_lights[i].type == 1) {
-			lightDir= normalize(u_lights[i].position - texture(u_Position, TexCoords).xyz);
+		if(isPoint(light)) {
+			lightDir= normalize(light.position - position);
 		} else {
-			lightDir= normalize(u_lights[i].position);
+			lightDir= normalize(light.position);
 		}
-		float diff = max(dot(normal, lightDir), 0.0);
+		float diff = max(dot(normal, lightDir), 0.0) * lightAttenuation(position, light);
 
-		float lightTransmittance = 0.5 + 0.5 * lightMarch(position, u_lights[i]); // Arbitrary, to account for ambient light
+		float lightTransmittance = 0.5 + 0.5 * surfaceTransmittance(position, light); // Arbitrary, to account for ambient light
 
-		diffuse += albedo * diff * u_lights[i].color * u_lights[i].intensity * lightTransmittance;
+		diffuse += albedo * diff * light.color * light.intensity * lightTransmittance;
 	}
 
 	return ambient + diffuse;
 }
 
 void main() {
-	vec3 albedo = texture(u_Albedo, TexCoords).rgb;
-	vec3 normal = texture(u_Normal, TexCoords).rgb;
-	vec3 position = texture(u_Position, TexCoords).rgb;
+	selectLightTile(TexCoords);
 
-	// --- Raymarching ---
-	vec2 uv = TexCoords * 2.0 - 1.0;
+	float depth = texture(u_Depth, TexCoords).r;
+	vec3 position = reconstructPosition(TexCoords, depth);
 
-	// Primary ray generation
-
-	vec4 clip = vec4(uv, -1.0, 1.0);
-	vec4 eye = vec4(vec2(u_invProjMat * clip), -1.0, 0.0);
-	vec3 rayDir = normalize(vec3(u_invViewMat * eye));
+	vec3 rayDir = primaryRayDir(TexCoords);
 	vec3 rayOrigin = u_invViewMat[3].xyz;
 
 	float trender = length(position - rayOrigin);
-	if(position == vec3(0)) trender = 1000000.0;
-	
-	vec4 cloudColor = raymarchCloud(rayOrigin, rayDir, trender);
+	if(isSky(depth)) trender = SKY_DISTANCE;
+
+	// The clouds were raymarched by the cloud pass
+	vec4 cloudColor = upsampleClouds(TexCoords, trender);
 	vec3 lightEnergy = cloudColor.rgb;
 	float transmittance = cloudColor.a;
 
 	vec3 renderColor = vec3(0);
 
-	if(position == vec3(0)) { // Sky color
+	if(isSky(depth)) { // Sky color
 		renderColor = getSkyColor(rayDir);
 	} else { // Solid objects color
+		vec3 albedo = texture(u_Albedo, TexCoords).rgb;
+		vec3 normal = decodeNormal(texture(u_Normal, TexCoords).rg);
 		renderColor = computeRenderColor(albedo, normal, position);
 	}
 
@@ -0,0 +1,91 @@
+#version 430
+
+// Bakes tileable 3D noises, sampled by compute.glsl instead of evaluating simplex noise at every voxel.
+// Base noise:   R = Perlin-Worley, G, B, A = Worley fbm at increasing frequencies
+// Detail noise: R, G, B = Worley fbm at increasing frequencies
+
+layout (local_size_x = 8, local_size_y = 8, local_size_z = 8) in;
+
+layout (rgba8, binding = 0) writeonly uniform image3D img_output;
+
+uniform int u_resolution;
+uniform int u_detail; // 0 for the base noise, 1 for the detail noise
+
+vec3 hash33(vec3 p) { // Hash without sine, from https://www.shadertoy.com/view/4djSRW
+	p = fract(p * vec3(0.1031, 0.1030, 0.0973));
+	p += dot(p, p.yxz + 33.33);
+	return fract((p.xxy + p.yxx) * p.zyx);
+}
+
+// Inverted F1 Worley noise, tiling with the given number of cells per unit
+float worley(vec3 p, float cells) {
+	p *= cells;
+	vec3 cell = floor(p);
+	float minDist = 1.0;
+
+	for(int x = -1; x <= 1; x++)
+	for(int y = -1; y <= 1; y++)
+	for(int z = -1; z <= 1; z++) {
+		vec3 neighbour = cell + vec3(x, y, z);
+		vec3 featurePoint = neighbour + hash33(mod(neighbour, cells));
+		minDist = min(minDist, length(featurePoint - p));
+	}
+
+	return 1.0 - minDist;
+}
+
+// Gradient noise in [-1, 1], tiling with the given period
+float perlin(vec3 p, float period) {
+	p *= period;
+	vec3 cell = floor(p);
+	vec3 f = p - cell;
+	vec3 u = f * f * f * (f * (f * 6.0 - 15.0) + 10.0); // Quintic fade
+
+	float corners[8];
+	for(int i = 0; i < 8; i++) {
+		vec3 offset = vec3(i & 1, (i >> 1) & 1, (i >> 2) & 1);
+		vec3 gradient = normalize(hash33(mod(cell + offset, period)) * 2.0 - 1.0);
+		corners[i] = dot(gradient, f - offset);
+	}
+
+	float x0 = mix(mix(corners[0], corners[1], u.x), mix(corners[2], corners[3], u.x), u.y);
+	float x1 = mix(mix(corners[4], corners[5], u.x), mix(corners[6], corners[7], u.x), u.y);
+	return mix(x0, x1, u.z) * 1.5;
+}
+
+float perlinFbm(vec3 p, float period, int octaves) {
+	float sum = 0.0, amplitude = 1.0, ampSum = 0.0;
+	for(int i = 0; i < octaves; i++) {
+		sum += perlin(p, period) * amplitude;
+		ampSum += amplitude;
+		amplitude *= 0.5;
+		period *= 2.0;
+	}
+	return sum / ampSum;
+}
+
+float worleyFbm(vec3 p, float cells) {
+	return worley(p, cells) * 0.625 + worley(p, cells * 2.0) * 0.25 + worley(p, cells * 4.0) * 0.125;
+}
+
+float remap(float value, float oldMin, float oldMax, float newMin, float newMax) {
+	return newMin + (value - oldMin) / (oldMax - oldMin) * (newMax - newMin);
+}
+
+void main() {
+	ivec3 coords = ivec3(gl_GlobalInvocationID);
+	vec3 p = (vec3(coords) + 0.5) / float(u_resolution);
+
+	vec4 noise;
+	if(u_detail == 0) {
+		float perlinNoise = perlinFbm(p, 4.0, 4) * 0.5 + 0.5;
+		float worleyNoise = worleyFbm(p, 4.0);
+		float perlinWorley = clamp(remap(perlinNoise, worleyNoise - 1.0, 1.0, 0.0, 1.0), 0.0, 1.0);
+
+		noise = vec4(perlinWorley, worleyFbm(p, 4.0), worleyFbm(p, 8.0), worleyFbm(p, 16.0));
+	} else {
+		noise = vec4(worleyFbm(p, 4.0), worleyFbm(p, 8.0), worleyFbm(p, 16.0), 1.0);
+	}
+
+	imageStore(img_output, coords, clamp(noise, 0.0, 1.0));
+}
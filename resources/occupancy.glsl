@@ -0,0 +1,47 @@
+#version 430
+
+// Max-density occupancy grid, one level per dispatch.
+// Level 0: max of a brick of the density volume, with a 1-voxel border so that any trilinear sample inside the brick is covered.
+// Next levels: max of the 2x2x2 cells of the previous level (3 on the last cell of an odd axis).
+
+layout (local_size_x = 4, local_size_y = 4, local_size_z = 4) in;
+
+layout (r32f, binding = 0) writeonly uniform image3D img_output;
+layout (r32f, binding = 1) readonly uniform image3D img_previous; // Level u_level - 1
+
+uniform sampler3D u_volume;
+uniform int u_level;
+uniform int u_brickSize;
+
+void main() {
+	ivec3 cell = ivec3(gl_GlobalInvocationID);
+	ivec3 size = imageSize(img_output);
+	if(any(greaterThanEqual(cell, size))) return;
+
+	float maxDensity = 0.0;
+
+	if(u_level == 0) {
+		ivec3 volumeSize = textureSize(u_volume, 0);
+		ivec3 first = max(cell * u_brickSize - 1, ivec3(0));
+		ivec3 last = min(cell * u_brickSize + u_brickSize, volumeSize - 1);
+
+		for(int z = first.z; z <= last.z; z++)
+			for(int y = first.y; y <= last.y; y++)
+				for(int x = first.x; x <= last.x; x++)
+					maxDensity = max(maxDensity, texelFetch(u_volume, ivec3(x, y, z), 0).r);
+	} else {
+		ivec3 previousSize = imageSize(img_previous);
+		ivec3 first = cell * 2;
+		ivec3 last = min(cell * 2 + 1, previousSize - 1);
+		if(cell.x == size.x - 1) last.x = previousSize.x - 1;
+		if(cell.y == size.y - 1) last.y = previousSize.y - 1;
+		if(cell.z == size.z - 1) last.z = previousSize.z - 1;
+
+		for(int z = first.z; z <= last.z; z++)
+			for(int y = first.y; y <= last.y; y++)
+				for(int x = first.x; x <= last.x; x++)
+					maxDensity = max(maxDensity, imageLoad(img_previous, ivec3(x, y, z)).r);
+	}
+
+	imageStore(img_output, cell, vec4(maxDensity));
+}
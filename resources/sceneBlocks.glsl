@@ -0,0 +1,39 @@
+// Camera and lights uniform blocks, shared by every program lighting the scene. Included after the #version line.
+
+layout(std140) uniform CameraBlock {
+	mat4 u_viewMat;
+	mat4 u_projMat;
+	mat4 u_invViewMat;
+	mat4 u_invProjMat;
+	mat4 u_proj_viewMat;
+	vec4 u_cameraPosition;
+};
+
+// World position of a pixel of the G-buffer from its depth, both in [0, 1]
+vec3 reconstructPosition(vec2 texCoords, float depth) {
+	vec4 view = u_invProjMat * vec4(vec3(texCoords, depth) * 2.0 - 1.0, 1.0);
+	return (u_invViewMat * vec4(view.xyz / view.w, 1.0)).xyz;
+}
+
+// Nothing was drawn there: the depth buffer kept its clear value
+bool isSky(float depth) {
+	return depth == 1.0;
+}
+
+#define MAX_LIGHTS 256 // Must match MAX_LIGHTS in scene.hpp
+
+struct Light {
+	int type; // 0 = ambiant, 1 = point, 2 = directional
+	int transmittanceChannel; // Channel of u_transmittance, -1 if the light is not baked
+	vec3 position;
+	float radius; // Range of a point light
+	vec3 color;
+	float intensity;
+};
+
+layout(std140) uniform LightsBlock {
+	Light u_lights[MAX_LIGHTS];
+	int u_numLights;
+};
+
+#define MAX_LIGHTS_PER_TILE 64 // Must match LightCulling::MAX_LIGHTS_PER_TILE
@@ -0,0 +1,55 @@
+#version 430
+
+// Statistics of a tile of the previous frame of the cloud pass, and the ray budget they give it for the next frame.
+// The tile is read with a margin, so that the budget is already high next to a moving cloud edge.
+
+layout (local_size_x = 8, local_size_y = 8) in;
+
+layout (rgba16f, binding = 0) writeonly uniform image2D img_output; // Coverage, mean transmittance, variance, budget
+
+uniform sampler2D u_cloud;
+uniform int u_tileSize;
+uniform bool u_valid;     // False when there is no previous frame
+uniform float u_minBudget;
+
+#define TILE_MARGIN 4
+#define COVERAGE_THRESHOLD 0.99 // A pixel with a lower transmittance is covered by clouds
+#define STDDEV_SCALE 4.0        // Standard deviation of the transmittance from which a tile gets the whole budget
+
+void main() {
+	ivec2 tile = ivec2(gl_GlobalInvocationID.xy);
+	if(any(greaterThanEqual(tile, imageSize(img_output)))) return;
+
+	if(!u_valid) {
+		imageStore(img_output, tile, vec4(0.0, 1.0, 0.0, 1.0));
+		return;
+	}
+
+	ivec2 size = textureSize(u_cloud, 0);
+	ivec2 first = max(tile * u_tileSize - TILE_MARGIN, ivec2(0));
+	ivec2 last = min(tile * u_tileSize + u_tileSize + TILE_MARGIN, size) - 1;
+
+	float covered = 0.0;
+	float sum = 0.0;
+	float sumSquares = 0.0;
+	for(int y = first.y; y <= last.y; y++) {
+		for(int x = first.x; x <= last.x; x++) {
+			float transmittance = texelFetch(u_cloud, ivec2(x, y), 0).a;
+			covered += transmittance < COVERAGE_THRESHOLD ? 1.0 : 0.0;
+			sum += transmittance;
+			sumSquares += transmittance * transmittance;
+		}
+	}
+
+	float count = float((last.x - first.x + 1) * (last.y - first.y + 1));
+	float coverage = covered / count;
+	float mean = sum / count;
+	float variance = max(sumSquares / count - mean * mean, 0.0);
+
+	// Partly covered tiles hold cloud edges, a varying transmittance thin or broken clouds
+	float edge = 4.0 * coverage * (1.0 - coverage);
+	float detail = min(sqrt(variance) * STDDEV_SCALE, 1.0);
+	float budget = mix(u_minBudget, 1.0, max(edge, detail));
+
+	imageStore(img_output, tile, vec4(coverage, mean, variance, budget));
+}
@@ -3,16 +3,55 @@
 
 #include "gl_includes.hpp"
 #include "shader.hpp"
+#include "uniformbuffer.hpp"
+#include "lighttransmittance.hpp"
 
+#include <string>
 
-const int MAX_LIGHTS = 10;
+
+// Must match MAX_LIGHTS in sceneBlocks.glsl. The lights are culled per screen tile, so most of them only cost the culling pass.
+// LightsBlockUniforms must stay within the 16 KiB of uniform block guaranteed by OpenGL.
+const int MAX_LIGHTS = 256;
+const float MIN_LIGHT_RADIUS = 0.1f;      // Smallest range of a point light, as on the radius slider
+const float DEFAULT_LIGHT_RADIUS = 10.0f; // Range given to a new point light
 
 struct Light {
     int type; // 0 = ambiant, 1 = point, 2 = directional
     glm::vec3 position;
     glm::vec3 color;
     float intensity;
+    float radius; // Range of a point light, beyond which it is culled
+};
+
+// std140 layout of a Light in the LightsBlock uniform block
+struct LightUniforms {
+    int type;
+    int transmittanceChannel; // Channel of the light transmittance volume, -1 if the light has none
+    int pad0[2];
+    glm::vec3 position;
+    float radius;
+    glm::vec3 color;
+    float intensity;
+};
+static_assert(sizeof(LightUniforms) == 48, "LightUniforms must match the std140 layout of Light");
+
+struct LightsBlockUniforms {
+    LightUniforms lights[MAX_LIGHTS];
+    int numLights;
+    int pad[3];
 };
+static_assert(sizeof(LightsBlockUniforms) <= 16384, "LightsBlockUniforms must fit in GL_MAX_UNIFORM_BLOCK_SIZE");
+
+// std140 layout of the CameraBlock uniform block
+struct CameraUniforms {
+    glm::mat4 viewMat;
+    glm::mat4 projMat;
+    glm::mat4 invViewMat;
+    glm::mat4 invProjMat;
+    glm::mat4 projViewMat;
+    glm::vec4 cameraPosition;
+};
+static_assert(sizeof(CameraUniforms) == 336, "CameraUniforms must match the std140 layout of CameraBlock");
 
 class Scene {
 public:
@@ -24,34 +63,84 @@ public:
     
     Camera m_camera {};
 
+    float m_time = 0.0f; // Animation time, in seconds
+
+    UniformBuffer<CameraUniforms> m_cameraBuffer {};
+    UniformBuffer<LightsBlockUniforms> m_lightsBuffer {};
+
+
+    // Uploads the camera and lights uniform blocks, only for the ones that changed since the last call
+    void updateUniformBuffers() {
+        const glm::mat4 viewMatrix = m_camera.computeViewMatrix();
+        const glm::mat4 projMatrix = m_camera.computeProjectionMatrix();
+
+        CameraUniforms camera {};
+        camera.viewMat = viewMatrix;
+        camera.projMat = projMatrix;
+        camera.invViewMat = glm::inverse(viewMatrix);
+        camera.invProjMat = glm::inverse(projMatrix);
+        camera.projViewMat = projMatrix * viewMatrix;
+        camera.cameraPosition = glm::vec4(m_camera.getPosition(), 1.0f);
+
+        m_cameraBuffer.set(camera);
+        m_cameraBuffer.upload();
 
-    void setUniforms(GLuint lightingShader) {
+        LightsBlockUniforms lights {};
+        int channel = 0;
         for(int i = 0; i < m_numLights; i++) {
-            setUniform(lightingShader, std::string("u_lights[" + std::to_string(i) + "].type").c_str(), m_lights[i].type);
-            setUniform(lightingShader, std::string("u_lights[" + std::to_string(i) + "].position").c_str(), m_lights[i].position);
-            setUniform(lightingShader, std::string("u_lights[" + std::to_string(i) + "].color").c_str(), m_lights[i].color);
-            setUniform(lightingShader, std::string("u_lights[" + std::to_string(i) + "].intensity").c_str(), m_lights[i].intensity);
+            bool hasChannel = m_lights[i].type == 2 && channel < LightTransmittance::MAX_LIGHTS;
+
+            lights.lights[i].type = m_lights[i].type;
+            lights.lights[i].transmittanceChannel = hasChannel ? channel++ : -1;
+            lights.lights[i].position = m_lights[i].position;
+            lights.lights[i].color = m_lights[i].color;
+            lights.lights[i].intensity = m_lights[i].intensity;
+            lights.lights[i].radius = glm::max(m_lights[i].radius, MIN_LIGHT_RADIUS); // e.g. a directional light switched to point
         }
+        lights.numLights = m_numLights;
 
-        setUniform(lightingShader, "u_numLights", m_numLights);
+        m_lightsBuffer.set(lights);
+        m_lightsBuffer.upload();
     }
 
-    void setGeometryUniforms(GLuint geometryShader) {
-        const glm::mat4 viewMatrix = m_camera.computeViewMatrix();
-        const glm::mat4 projMatrix = m_camera.computeProjectionMatrix();
-        
-        setUniform(geometryShader, "u_viewMat", viewMatrix);
-        setUniform(geometryShader, "u_projMat", projMatrix);
-        setUniform(geometryShader, "u_proj_viewMat", projMatrix * viewMatrix);
+    // Directions of the lights with a channel in the light transmittance volume: the first directional lights,
+    // in the same order as the channels of updateUniformBuffers(). Returns their number.
+    int transmittanceDirections(glm::vec3 directions[LightTransmittance::MAX_LIGHTS]) const {
+        int count = 0;
+        for(int i = 0; i < m_numLights && count < LightTransmittance::MAX_LIGHTS; i++) {
+            if(m_lights[i].type == 2) directions[count++] = m_lights[i].position;
+        }
+        return count;
+    }
+
+    // Light types present in the scene, compiled into the variants of the lighting programs (see cloudCommon.glsl)
+    std::string lightTypeDefines() const {
+        bool types[3] = { false, false, false };
+        for(int i = 0; i < m_numLights; i++) {
+            if(m_lights[i].type >= 0 && m_lights[i].type < 3) types[m_lights[i].type] = true;
+        }
 
+        std::string defines;
+        defines += std::string("#define HAS_AMBIENT_LIGHTS ") + (types[0] ? "true" : "false") + "\n";
+        defines += std::string("#define HAS_POINT_LIGHTS ") + (types[1] ? "true" : "false") + "\n";
+        defines += std::string("#define HAS_DIRECTIONAL_LIGHTS ") + (types[2] ? "true" : "false") + "\n";
+        return defines;
+    }
+
+    void setGeometryUniforms(GLuint geometryShader) {
         setUniform(geometryShader, "u_modelMat", glm::mat4(1.0f));
         setUniform(geometryShader, "u_transposeInverseModelMat", glm::mat4(1.0f));
 
-        setUniform(geometryShader, "u_cameraPosition", m_camera.getPosition());
-
-        setUniform(geometryShader, "u_time", static_cast<float>(glfwGetTime()));
+        setUniform(geometryShader, "u_time", m_time);
     } 
 
+    // Frees the meshes and uniform buffers, while the context is still alive
+    void release() {
+        m_objects.clear();
+        m_cameraBuffer.release();
+        m_lightsBuffer.release();
+    }
+
     void init(int width, int height) {
         m_objects.push_back(std::make_shared<Object3D>(Mesh::genSphere(16)));
         m_objects.push_back(std::make_shared<Object3D>(Mesh::genSubdividedPlane(2)));
@@ -65,10 +154,14 @@ public:
             2,
             glm::vec3(0.5f, 1.0f, 0.5f),
             glm::vec3(1.0, 1.0, 1.0),
-            1.0f
+            1.0f,
+            0.0f
         };
 
         initCamera(width, height);
+
+        m_cameraBuffer.init(CAMERA_BLOCK_BINDING);
+        m_lightsBuffer.init(LIGHTS_BLOCK_BINDING);
     }
 
     void initCamera(int width, int height) {
@@ -10,11 +10,49 @@
 #include <fstream>
 #include <string>
 #include <sstream>
+#include <unordered_map>
 
-void loadShader(GLuint program, GLenum type, const std::string &shaderFilename) {
+// Uniform locations, cached per program to avoid querying the driver by name on every call
+static std::unordered_map<GLuint, std::unordered_map<std::string, GLint>> s_uniformLocations {};
+
+// Replaces the lines #include "file" by the content of the file, relative to the directory of the including file
+static std::string resolveIncludes(const std::string &source, const std::string &filename, std::vector<std::string> *files,
+                                   int depth = 0) {
+    if (depth > 16) {
+        std::cerr << "ERROR: Too many nested includes in '" << filename << "'" << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+
+    std::string directory = filename.substr(0, filename.find_last_of("/\\") + 1);
+
+    std::istringstream input(source);
+    std::ostringstream output;
+    std::string line;
+    while (std::getline(input, line)) {
+        size_t directive = line.find("#include");
+        size_t open = line.find('"', directive);
+        size_t close = open == std::string::npos ? std::string::npos : line.find('"', open + 1);
+
+        if (directive == std::string::npos || close == std::string::npos || line.find_first_not_of(" \t") != directive) {
+            output << line << '\n';
+            continue;
+        }
+
+        std::string includeFilename = directory + line.substr(open + 1, close - open - 1);
+        if (files) files->push_back(includeFilename);
+        output << resolveIncludes(file2String(includeFilename), includeFilename, files, depth + 1) << '\n';
+    }
+    return output.str();
+}
+
+std::string loadShaderSource(const std::string &filename, std::vector<std::string> *files) {
+    if (files) files->push_back(filename);
+    return resolveIncludes(file2String(filename), filename, files);
+}
+
+GLuint compileShader(GLenum type, const std::string &source, const std::string &name) {
     GLuint shader = glCreateShader(type);                                     // Create the shader, e.g., a vertex shader to be applied to every single vertex of a mesh
-    std::string shaderSourceString = file2String(shaderFilename);             // Loads the shader source from a file to a C++ string
-    const GLchar *shaderSource = (const GLchar *)shaderSourceString.c_str();  // Interface the C++ string through a C pointer
+    const GLchar *shaderSource = (const GLchar *)source.c_str();              // Interface the C++ string through a C pointer
     glShaderSource(shader, 1, &shaderSource, NULL);                           // load the vertex shader code
     glCompileShader(shader);
     GLint success;
@@ -22,8 +60,16 @@ void loadShader(GLuint program, GLenum type, const std::string &shaderFilename)
     glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
     if (!success) {
         glGetShaderInfoLog(shader, 512, NULL, infoLog);
-        std::cout << "ERROR in compiling " << shaderFilename << "\n\t" << infoLog << std::endl;
+        std::cout << "ERROR in compiling " << name << "\n\t" << infoLog << std::endl;
+        glDeleteShader(shader);
+        return 0;
     }
+    return shader;
+}
+
+void loadShader(GLuint program, GLenum type, const std::string &shaderFilename) {
+    GLuint shader = compileShader(type, loadShaderSource(shaderFilename), shaderFilename);
+    if (!shader) return;
     glAttachShader(program, shader);
     glDeleteShader(shader);
 }
@@ -41,31 +87,63 @@ std::string file2String(const std::string &filename) {
     return buffer.str();
 }
 
-void setUniform(GLuint program, const std::string &name, float x) {
+GLint getUniformLocation(GLuint program, const std::string &name) {
+    std::unordered_map<std::string, GLint> &locations = s_uniformLocations[program];
+
+    auto it = locations.find(name);
+    if (it != locations.end()) return it->second;
+
     GLint loc = glGetUniformLocation(program, name.c_str());
+    locations[name] = loc;
+    return loc;
+}
+
+void forgetUniformLocations(GLuint program) {
+    s_uniformLocations.erase(program);
+}
+
+void bindUniformBlock(GLuint program, const std::string &blockName, GLuint binding) {
+    GLuint index = glGetUniformBlockIndex(program, blockName.c_str());
+    if (index != GL_INVALID_INDEX) glUniformBlockBinding(program, index, binding);  // The block may be optimized out if unused
+}
+
+void setUniform(GLuint program, const std::string &name, float x) {
+    GLint loc = getUniformLocation(program, name);
     glUniform1f(loc, x);
 }
 void setUniform(GLuint program, const std::string &name, int x) {
-    GLint loc = glGetUniformLocation(program, name.c_str());
+    GLint loc = getUniformLocation(program, name);
     glUniform1i(loc, x);
 }
 void setUniform(GLuint program, const std::string &name, bool x) {
-    GLint loc = glGetUniformLocation(program, name.c_str());
+    GLint loc = getUniformLocation(program, name);
     glUniform1i(loc, x);
 }
+void setUniform(GLuint program, const std::string &name, const glm::vec2 &v) {
+    GLint loc = getUniformLocation(program, name);
+    glUniform2fv(loc, 1, glm::value_ptr(v));
+}
+void setUniform(GLuint program, const std::string &name, const glm::ivec2 &v) {
+    GLint loc = getUniformLocation(program, name);
+    glUniform2i(loc, v.x, v.y);
+}
 void setUniform(GLuint program, const std::string &name, const glm::vec3 &v) {
-    GLint loc = glGetUniformLocation(program, name.c_str());
+    GLint loc = getUniformLocation(program, name);
     glUniform3fv(loc, 1, glm::value_ptr(v));
 }
+void setUniform(GLuint program, const std::string &name, const glm::ivec3 &v) {
+    GLint loc = getUniformLocation(program, name);
+    glUniform3i(loc, v.x, v.y, v.z);
+}
 void setUniform(GLuint program, const std::string &name, const glm::vec4 &v) {
-    GLint loc = glGetUniformLocation(program, name.c_str());
+    GLint loc = getUniformLocation(program, name);
     glUniform4fv(loc, 1, glm::value_ptr(v));
 }
 void setUniform(GLuint program, const std::string &name, const glm::mat3 &m) {
-    GLint loc = glGetUniformLocation(program, name.c_str());
+    GLint loc = getUniformLocation(program, name);
     glUniformMatrix3fv(loc, 1, GL_FALSE, glm::value_ptr(m));
 }
 void setUniform(GLuint program, const std::string &name, const glm::mat4 &m) {
-    GLint loc = glGetUniformLocation(program, name.c_str());
+    GLint loc = getUniformLocation(program, name);
     glUniformMatrix4fv(loc, 1, GL_FALSE, glm::value_ptr(m));
 }
\ No newline at end of file
@@ -10,14 +10,27 @@
 
 #include "gl_includes.hpp"
 #include <string>
+#include <vector>
 
 std::string file2String(const std::string &filename);
 void loadShader(GLuint program, GLenum type, const std::string &shaderFilename);
 
+// Source of a shader file with its #include lines resolved. The files read, itself included, are appended to files.
+std::string loadShaderSource(const std::string &filename, std::vector<std::string> *files = nullptr);
+// Returns 0 and prints the log if the compilation fails. name is only used in the log.
+GLuint compileShader(GLenum type, const std::string &source, const std::string &name);
+
+GLint getUniformLocation(GLuint program, const std::string &name);
+void forgetUniformLocations(GLuint program); // To call before deleting or relinking a program
+void bindUniformBlock(GLuint program, const std::string &blockName, GLuint binding);
+
 void setUniform(GLuint program, const std::string &name, float x);
 void setUniform(GLuint program, const std::string &name, int x);
 void setUniform(GLuint program, const std::string &name, bool x);
+void setUniform(GLuint program, const std::string &name, const glm::vec2 &v);
+void setUniform(GLuint program, const std::string &name, const glm::ivec2 &v);
 void setUniform(GLuint program, const std::string &name, const glm::vec3 &v);
+void setUniform(GLuint program, const std::string &name, const glm::ivec3 &v);
 void setUniform(GLuint program, const std::string &name, const glm::vec4 &v);
 void setUniform(GLuint program, const std::string &name, const glm::mat3 &m);
 void setUniform(GLuint program, const std::string &name, const glm::mat4 &m);
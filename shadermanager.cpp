@@ -0,0 +1,375 @@
+/*
+    shadermanager.cpp
+
+    Program binary cache and source watcher of shadermanager.hpp.
+*/
+
+#include "shadermanager.hpp"
+#include "shader.hpp"
+#include "hash.hpp"
+
+#include "imgui.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#include <sys/utime.h>
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <utime.h>
+#endif
+
+struct ShaderCacheHeader {
+    char magic[4];         // "SHPB"
+    uint32_t fileVersion;  // Layout of this header
+    uint64_t key;          // Hash of the driver and of the preprocessed sources
+    uint32_t binaryFormat; // As returned by glGetProgramBinary
+    uint32_t dataSize;     // Bytes of binary after the header
+};
+
+// Modification time and size, -1 if the file cannot be read (e.g. while an editor replaces it)
+static std::pair<int64_t, int64_t> fileStamp(const std::string &filename) {
+    struct stat st;
+    if (stat(filename.c_str(), &st) != 0) return std::make_pair(int64_t(-1), int64_t(-1));
+    return std::make_pair(static_cast<int64_t>(st.st_mtime), static_cast<int64_t>(st.st_size));
+}
+
+static void makeDirectory(const std::string &path) {
+#ifdef _WIN32
+    _mkdir(path.c_str());
+#else
+    mkdir(path.c_str(), 0755);
+#endif
+}
+
+// Names of the files of a directory ending with extension
+static std::vector<std::string> listFiles(const std::string &directory, const std::string &extension) {
+    std::vector<std::string> files;
+#ifdef _WIN32
+    WIN32_FIND_DATAA data;
+    HANDLE find = FindFirstFileA((directory + "*" + extension).c_str(), &data);
+    if (find == INVALID_HANDLE_VALUE) return files;
+    do {
+        files.push_back(data.cFileName);
+    } while (FindNextFileA(find, &data));
+    FindClose(find);
+#else
+    DIR *dir = opendir(directory.c_str());
+    if (!dir) return files;
+    while (dirent *entry = readdir(dir)) {
+        std::string name = entry->d_name;
+        if (name.size() > extension.size() && name.compare(name.size() - extension.size(), extension.size(), extension) == 0)
+            files.push_back(name);
+    }
+    closedir(dir);
+#endif
+    return files;
+}
+
+// Sets the modification time to now, which orders the cache entries by last use
+static void touchFile(const std::string &filename) {
+#ifdef _WIN32
+    _utime(filename.c_str(), nullptr);
+#else
+    utime(filename.c_str(), nullptr);
+#endif
+}
+
+static uint64_t hashString(const char *string, uint64_t seed) {
+    return string ? hashBytes(string, std::strlen(string), seed) : seed;
+}
+
+const uint32_t ShaderManager::FILE_VERSION;
+const int ShaderManager::MAX_CACHE_ENTRIES;
+
+// Inserts the defines after the #version line, which has to stay the first statement of the source
+static std::string injectDefines(const std::string &source, const std::string &defines) {
+    if (defines.empty()) return source;
+
+    size_t version = source.find("#version");
+    size_t lineEnd = version == std::string::npos ? std::string::npos : source.find('\n', version);
+    if (lineEnd == std::string::npos) return defines + source;
+
+    return source.substr(0, lineEnd + 1) + defines + source.substr(lineEnd + 1);
+}
+
+ShaderManager &ShaderManager::instance() {
+    // Never destroyed: the owners of programs may release them from the destructors of globals, after this one
+    static ShaderManager *manager = new ShaderManager();
+    return *manager;
+}
+
+ShaderManager::~ShaderManager() {
+    stopWatching();
+}
+
+GLuint ShaderManager::create(const std::vector<ShaderStage> &stages, const SetupFunction &setup, const std::string &defines) {
+    if (!m_driverHash) {
+        // A driver update may change the binary format, or reject binaries of the previous version
+        m_driverHash = hashString(reinterpret_cast<const char *>(glGetString(GL_VENDOR)), hashBytes(&FILE_VERSION, sizeof(FILE_VERSION)));
+        m_driverHash = hashString(reinterpret_cast<const char *>(glGetString(GL_RENDERER)), m_driverHash);
+        m_driverHash = hashString(reinterpret_cast<const char *>(glGetString(GL_VERSION)), m_driverHash);
+
+        if (m_cacheEnabled) pruneCache();
+    }
+
+    Program program { stages, setup, defines, {} };
+    GLuint id = build(program);
+    if (id) {
+        if (setup) setup(id);
+    } else {
+        id = glCreateProgram(); // Empty, but a valid handle for the owner, filled by the first reload that succeeds
+    }
+
+    watchFiles(program.files);
+    m_programs[id] = program;
+    return id;
+}
+
+void ShaderManager::destroy(GLuint program) {
+    if (!program) return;
+    m_programs.erase(program);
+    forgetUniformLocations(program);
+    glDeleteProgram(program);
+}
+
+GLuint ShaderManager::build(Program &program) {
+    program.files.clear();
+
+    std::vector<std::string> sources;
+    uint64_t key = m_driverHash;
+    for (const ShaderStage &stage : program.stages) {
+        sources.push_back(injectDefines(loadShaderSource(stage.filename, &program.files), program.defines));
+        key = hashBytes(&stage.type, sizeof(stage.type), key);
+        key = hashBytes(sources.back().data(), sources.back().size(), key);
+    }
+
+    if (m_cacheEnabled) {
+        GLuint id = glCreateProgram();
+        if (loadBinary(id, key)) {
+            m_cacheHits++;
+            return id;
+        }
+        glDeleteProgram(id);
+    }
+
+    m_cacheMisses++;
+    GLuint id = link(program.stages, sources);
+    if (id && m_cacheEnabled) storeBinary(id, key);
+    return id;
+}
+
+GLuint ShaderManager::link(const std::vector<ShaderStage> &stages, const std::vector<std::string> &sources) {
+    GLuint id = glCreateProgram();
+    glProgramParameteri(id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+
+    for (size_t i = 0; i < stages.size(); i++) {
+        GLuint shader = compileShader(stages[i].type, sources[i], stages[i].filename);
+        if (!shader) {
+            glDeleteProgram(id);
+            return 0;
+        }
+        glAttachShader(id, shader);
+        glDeleteShader(shader); // Freed with the program
+    }
+
+    glLinkProgram(id);
+    GLint success;
+    glGetProgramiv(id, GL_LINK_STATUS, &success);
+    if (!success) {
+        GLchar infoLog[512];
+        glGetProgramInfoLog(id, 512, NULL, infoLog);
+        std::cout << "ERROR in linking " << stages.back().filename << "\n\t" << infoLog << std::endl;
+        glDeleteProgram(id);
+        return 0;
+    }
+    return id;
+}
+
+int ShaderManager::reloadChanged() {
+    std::unordered_set<std::string> changed;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        changed.swap(m_changedFiles);
+    }
+    if (changed.empty()) return 0;
+
+    int rebuilt = 0;
+    for (auto &entry : m_programs) {
+        Program &program = entry.second;
+
+        bool affected = false;
+        for (const std::string &file : program.files) affected = affected || changed.count(file) > 0;
+        if (!affected) continue;
+
+        Program next = program;
+        GLuint id = build(next);
+        watchFiles(next.files); // The new version may include other files
+        if (!id) {
+            m_failedReloads++;
+            std::cout << "Keeping the previous version of " << program.stages.back().filename << std::endl;
+            continue;
+        }
+
+        // Moved into the existing program through its binary, so the handle held by the owner stays valid
+        GLint size = 0;
+        glGetProgramiv(id, GL_PROGRAM_BINARY_LENGTH, &size);
+        std::vector<char> binary(static_cast<size_t>(size));
+        GLenum format = 0;
+        if (size > 0) glGetProgramBinary(id, size, nullptr, &format, binary.data());
+        glDeleteProgram(id);
+
+        GLint success = GL_FALSE;
+        if (size > 0) {
+            glProgramBinary(entry.first, format, binary.data(), size);
+            glGetProgramiv(entry.first, GL_LINK_STATUS, &success);
+        }
+        if (!success) {
+            m_failedReloads++;
+            std::cout << "ERROR: The driver cannot reload " << program.stages.back().filename << " in place" << std::endl;
+            continue;
+        }
+
+        program.files = next.files;
+        forgetUniformLocations(entry.first);
+        if (program.setup) program.setup(entry.first);
+
+        std::cout << "Reloaded " << program.stages.back().filename << std::endl;
+        m_reloads++;
+        rebuilt++;
+    }
+    return rebuilt;
+}
+
+bool ShaderManager::loadBinary(GLuint program, uint64_t key) {
+    std::ifstream file(filename(key).c_str(), std::ios::binary);
+    if (!file.good()) return false;
+
+    ShaderCacheHeader header;
+    file.read(reinterpret_cast<char *>(&header), sizeof(header));
+    if (!file.good() || std::memcmp(header.magic, "SHPB", 4) != 0 || header.fileVersion != FILE_VERSION || header.key != key)
+        return false;
+
+    std::vector<char> binary(header.dataSize);
+    file.read(binary.data(), binary.size());
+    if (!file.good()) return false;
+
+    // Rejected if the driver changed in a way its version string does not tell, the program is then compiled
+    glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    glProgramBinary(program, header.binaryFormat, binary.data(), static_cast<GLsizei>(binary.size()));
+    GLint success;
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    if (success != GL_TRUE) return false;
+
+    touchFile(filename(key));
+    return true;
+}
+
+void ShaderManager::storeBinary(GLuint program, uint64_t key) {
+    GLint size = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &size);
+    if (size <= 0) return; // No binary format supported
+
+    ShaderCacheHeader header {};
+    std::memcpy(header.magic, "SHPB", 4);
+    header.fileVersion = FILE_VERSION;
+    header.key = key;
+    header.dataSize = static_cast<uint32_t>(size);
+
+    std::vector<char> binary(header.dataSize);
+    GLenum format = 0;
+    glGetProgramBinary(program, size, nullptr, &format, binary.data());
+    header.binaryFormat = format;
+
+    makeDirectory(m_directory);
+
+    // Written to a temporary file first, so that a concurrent run never reads a partial entry
+    std::string path = filename(key);
+    std::string tmpPath = path + ".tmp";
+    {
+        std::ofstream file(tmpPath.c_str(), std::ios::binary | std::ios::trunc);
+        if (!file.good()) {
+            std::cerr << "ERROR: Cannot write shader cache '" << tmpPath << "'" << std::endl;
+            return;
+        }
+        file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        file.write(binary.data(), binary.size());
+        if (!file.good()) return;
+    }
+
+    std::remove(path.c_str()); // rename does not overwrite on Windows
+    std::rename(tmpPath.c_str(), path.c_str());
+}
+
+void ShaderManager::pruneCache() {
+    std::vector<std::pair<int64_t, std::string>> entries; // Last use and path
+    for (const std::string &name : listFiles(m_directory, ".bin")) {
+        std::string path = m_directory + name;
+        entries.push_back(std::make_pair(fileStamp(path).first, path));
+    }
+    if (entries.size() <= static_cast<size_t>(MAX_CACHE_ENTRIES)) return;
+
+    std::sort(entries.begin(), entries.end()); // Oldest first
+    size_t excess = entries.size() - MAX_CACHE_ENTRIES;
+    for (size_t i = 0; i < excess; i++) {
+        if (std::remove(entries[i].second.c_str()) == 0) m_prunedEntries++;
+    }
+}
+
+std::string ShaderManager::filename(uint64_t key) const {
+    std::ostringstream name;
+    name << m_directory << std::hex << key << ".bin";
+    return name.str();
+}
+
+void ShaderManager::watchFiles(const std::vector<std::string> &files) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (const std::string &file : files) {
+        if (m_fileStamps.find(file) == m_fileStamps.end()) m_fileStamps[file] = fileStamp(file);
+    }
+}
+
+void ShaderManager::startWatching() {
+    if (m_watching) return;
+    m_watching = true;
+    m_watcher = std::thread(&ShaderManager::watch, this);
+}
+
+void ShaderManager::stopWatching() {
+    m_watching = false;
+    if (m_watcher.joinable()) m_watcher.join();
+}
+
+void ShaderManager::watch() {
+    while (m_watching) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(250));
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto &entry : m_fileStamps) {
+            std::pair<int64_t, int64_t> stamp = fileStamp(entry.first);
+            if (stamp.first < 0 || stamp == entry.second) continue;
+
+            entry.second = stamp;
+            m_changedFiles.insert(entry.first);
+        }
+    }
+}
+
+void ShaderManager::renderUI() {
+    ImGui::Text("Programs: %d, binary cache: %d hits / %d misses", static_cast<int>(m_programs.size()), m_cacheHits, m_cacheMisses);
+    ImGui::Text("Reloads: %d (%d failed), pruned cache entries: %d", m_reloads, m_failedReloads, m_prunedEntries);
+
+    if (ImGui::Button("Reload shaders")) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto &entry : m_fileStamps) m_changedFiles.insert(entry.first);
+    }
+}
@@ -0,0 +1,113 @@
+/*
+    shadermanager.hpp
+
+    Owns the GPU programs. Linked programs are cached on disk with glGetProgramBinary, keyed by a hash of the
+    preprocessed sources and of the driver, so that a run with unchanged shaders skips the compilation.
+    The cache keeps the MAX_CACHE_ENTRIES most recently used binaries, the others are deleted at startup.
+    A background thread watches the source files, included ones too, and the programs using a modified file are
+    rebuilt on the render thread by reloadChanged(), in place: the GLuint handed out stays valid.
+*/
+
+#ifndef SHADER_MANAGER_HPP
+#define SHADER_MANAGER_HPP
+
+#include "gl_includes.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+struct ShaderStage {
+    GLenum type;
+    std::string filename;
+};
+
+class ShaderManager {
+public:
+    // Called after every link of the program, to set what the link resets: samplers, block bindings, constant uniforms
+    typedef std::function<void(GLuint program)> SetupFunction;
+
+    static const uint32_t FILE_VERSION = 1;
+    static const int MAX_CACHE_ENTRIES = 256; // Every edit of a shader, and every variant, leaves a binary behind
+
+    std::string m_directory = "../cache/shaders/";
+    bool m_cacheEnabled = true;
+
+    int m_cacheHits = 0;
+    int m_cacheMisses = 0;
+    int m_reloads = 0;
+    int m_failedReloads = 0;
+    int m_prunedEntries = 0;
+
+public:
+    static ShaderManager &instance();
+
+    ~ShaderManager();
+
+    ShaderManager(const ShaderManager &) = delete;
+    ShaderManager &operator=(const ShaderManager &) = delete;
+
+    // defines, e.g. "#define A 1\n", are inserted after the #version line of each stage
+    GLuint create(const std::vector<ShaderStage> &stages, const SetupFunction &setup = SetupFunction(),
+                  const std::string &defines = std::string());
+    GLuint createCompute(const std::string &filename, const SetupFunction &setup = SetupFunction()) {
+        return create({ { GL_COMPUTE_SHADER, filename } }, setup);
+    }
+
+    void destroy(GLuint program);
+
+    // Starts the thread polling the modification times of the source files
+    void startWatching();
+    void stopWatching();
+
+    // Rebuilds the programs whose files changed since the last call. A program that fails to compile keeps its
+    // previous binary. Returns the number of programs rebuilt.
+    int reloadChanged();
+
+    // Widgets only, drawn in the window of the caller
+    void renderUI();
+
+private:
+    struct Program {
+        std::vector<ShaderStage> stages;
+        SetupFunction setup;
+        std::string defines;
+        std::vector<std::string> files; // Sources and their includes, as read by the last build
+    };
+
+    std::unordered_map<GLuint, Program> m_programs;
+    uint64_t m_driverHash = 0;
+
+    // Shared with the watcher thread
+    std::mutex m_mutex;
+    std::unordered_map<std::string, std::pair<int64_t, int64_t>> m_fileStamps; // Modification time and size
+    std::unordered_set<std::string> m_changedFiles;
+    std::thread m_watcher;
+    std::atomic<bool> m_watching { false };
+
+private:
+    ShaderManager() = default;
+
+    // Links the sources into a new program, from the cache if possible. Returns 0 if the compilation or link fails.
+    GLuint build(Program &program);
+    GLuint link(const std::vector<ShaderStage> &stages, const std::vector<std::string> &sources);
+
+    bool loadBinary(GLuint program, uint64_t key);
+    void storeBinary(GLuint program, uint64_t key);
+    std::string filename(uint64_t key) const;
+
+    // Deletes the least recently used binaries beyond MAX_CACHE_ENTRIES
+    void pruneCache();
+
+    void watchFiles(const std::vector<std::string> &files);
+    void watch();
+};
+
+#endif // SHADER_MANAGER_HPP
@@ -0,0 +1,58 @@
+#ifndef SHADER_VARIANTS_HPP
+#define SHADER_VARIANTS_HPP
+
+#include "gl_includes.hpp"
+#include "shadermanager.hpp"
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Variants of a program specialized by #defines, so that the compiler can unroll the loops and drop the branches
+// that depend on them. A variant is built by the ShaderManager the first time it is requested, then kept until
+// release(): switching back to a previous configuration costs nothing, and the binary cache makes the next run
+// skip the compilation too.
+class ShaderVariants {
+public:
+    bool m_enabled = true; // Else get() always returns the generic program, which reads the uniforms
+
+private:
+    std::vector<ShaderStage> m_stages {};
+    ShaderManager::SetupFunction m_setup {};
+    std::unordered_map<std::string, GLuint> m_programs {}; // By defines, "" for the generic program
+
+public:
+    ShaderVariants() = default;
+
+    ~ShaderVariants() {
+        release();
+    }
+
+    void init(const std::vector<ShaderStage> &stages, const ShaderManager::SetupFunction &setup) {
+        m_stages = stages;
+        m_setup = setup;
+    }
+
+    // Program for the given defines. They are the key of the variant, so they must be generated in a stable order.
+    GLuint get(const std::string &defines) {
+        std::string key = m_enabled ? "#define VARIANT\n" + defines : std::string();
+
+        auto it = m_programs.find(key);
+        if (it != m_programs.end()) return it->second;
+
+        GLuint program = ShaderManager::instance().create(m_stages, m_setup, key);
+        m_programs[key] = program;
+        return program;
+    }
+
+    int size() const {
+        return static_cast<int>(m_programs.size());
+    }
+
+    void release() {
+        for (auto &entry : m_programs) ShaderManager::instance().destroy(entry.second);
+        m_programs.clear();
+    }
+};
+
+#endif // SHADER_VARIANTS_HPP
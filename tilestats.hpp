@@ -0,0 +1,79 @@
+#ifndef TILE_STATS_HPP
+#define TILE_STATS_HPP
+
+#include "gl_includes.hpp"
+#include "shader.hpp"
+#include "shadermanager.hpp"
+
+// Per-tile statistics of the previous frame of the cloud pass, reduced by tileStats.glsl into a RGBA16F texture with
+// one texel per TILE_SIZE^2 pixels: cloud coverage, mean and variance of the transmittance, and the ray budget of
+// the tile for the next frame, as a fraction of MAX_STEPS and MAX_LIGHT_STEPS. Tiles on cloud edges get the whole
+// budget, fully clear or fully opaque ones minBudget.
+class TileStatistics {
+public:
+    static const int TILE_SIZE = 16; // In pixels of the cloud pass
+
+    GLuint m_program {};
+    GLuint m_texture {};
+    int m_width {};
+    int m_height {};
+
+public:
+    TileStatistics() = default;
+
+    ~TileStatistics() {
+        release();
+    }
+
+    void release() {
+        ShaderManager::instance().destroy(m_program);
+        if (m_texture) glDeleteTextures(1, &m_texture);
+        m_program = m_texture = 0;
+    }
+
+    void init() {
+        m_program = ShaderManager::instance().createCompute("../resources/tileStats.glsl", [](GLuint program) {
+            glUseProgram(program);
+            setUniform(program, "u_cloud", 0);
+            setUniform(program, "u_tileSize", TILE_SIZE);
+            glUseProgram(0);
+        });
+    }
+
+    // Reduces cloud, the previous frame of the cloud pass, of the given size. When it is not valid, every tile gets the whole budget.
+    void compute(GLuint cloud, int width, int height, bool valid, float minBudget) {
+        resize((width + TILE_SIZE - 1) / TILE_SIZE, (height + TILE_SIZE - 1) / TILE_SIZE);
+
+        glUseProgram(m_program);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, cloud);
+        setUniform(m_program, "u_valid", valid);
+        setUniform(m_program, "u_minBudget", minBudget);
+
+        glBindImageTexture(0, m_texture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+        glDispatchCompute((m_width + 7) / 8, (m_height + 7) / 8, 1);
+        glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+
+        glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glUseProgram(0);
+    }
+
+private:
+    void resize(int width, int height) {
+        if (m_texture && width == m_width && height == m_height) return;
+
+        if (m_texture) glDeleteTextures(1, &m_texture);
+        m_width = width;
+        m_height = height;
+
+        glGenTextures(1, &m_texture);
+        glBindTexture(GL_TEXTURE_2D, m_texture);
+        glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA16F, m_width, m_height);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+};
+
+#endif // TILE_STATS_HPP
@@ -0,0 +1,78 @@
+#ifndef UNIFORM_BUFFER_HPP
+#define UNIFORM_BUFFER_HPP
+
+#include "gl_includes.hpp"
+
+#include <cstring>
+
+// Binding points of the uniform blocks, shared by every program declaring them
+const GLuint CAMERA_BLOCK_BINDING = 0;
+const GLuint VOLUME_BLOCK_BINDING = 1;
+const GLuint LIGHTS_BLOCK_BINDING = 2;
+
+// Binding points of the shader storage blocks
+const GLuint TILE_LIGHTS_BUFFER_BINDING = 0; // Must match the binding of TileLightsBlock in the shaders
+const GLuint CULLING_STATS_BUFFER_BINDING = 1; // Must match the binding of CullingStatsBlock in lightCulling.glsl
+
+// A GPU buffer mirroring a std140 struct T.
+// T must be laid out exactly like the GLSL block, with explicit padding members, so it can be compared with memcmp.
+// Each actual change of the data bumps m_version, and the buffer is only re-uploaded when the version changed.
+template <typename T>
+class UniformBuffer {
+public:
+    GLuint m_buffer {};
+    GLuint m_binding {};
+
+    T m_data {};
+    unsigned int m_version = 1;
+
+private:
+    unsigned int m_uploadedVersion = 0;
+
+public:
+    UniformBuffer() = default;
+
+    ~UniformBuffer() {
+        release();
+    }
+
+    void release() {
+        if(m_buffer) glDeleteBuffers(1, &m_buffer);
+        m_buffer = 0;
+    }
+
+    void init(GLuint binding) {
+        m_binding = binding;
+
+        glGenBuffers(1, &m_buffer);
+        glBindBuffer(GL_UNIFORM_BUFFER, m_buffer);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(T), nullptr, GL_DYNAMIC_DRAW);
+        glBindBufferBase(GL_UNIFORM_BUFFER, m_binding, m_buffer);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+        m_uploadedVersion = m_version - 1;
+    }
+
+    // Returns true if the data changed
+    bool set(const T &data) {
+        if(std::memcmp(&data, &m_data, sizeof(T)) == 0) return false;
+
+        m_data = data;
+        m_version++;
+        return true;
+    }
+
+    // Returns true if the buffer was actually uploaded
+    bool upload() {
+        if(m_version == m_uploadedVersion) return false;
+
+        glBindBuffer(GL_UNIFORM_BUFFER, m_buffer);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(T), &m_data);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+        m_uploadedVersion = m_version;
+        return true;
+    }
+};
+
+#endif // UNIFORM_BUFFER_HPP
@@ -0,0 +1,199 @@
+/*
+    volumecache.cpp
+
+    Implementation of the volume cache and of the platform-specific file mapping.
+*/
+
+#include "volumecache.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#ifdef _WIN32
+#include <direct.h>
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+bool MappedFile::map(const std::string &filename) {
+    unmap();
+
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) return false;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+        CloseHandle(file);
+        return false;
+    }
+
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mapping) {
+        CloseHandle(file);
+        return false;
+    }
+
+    void *data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!data) {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        return false;
+    }
+
+    m_fileHandle = file;
+    m_mappingHandle = mapping;
+    m_data = static_cast<const unsigned char *>(data);
+    m_size = static_cast<size_t>(size.QuadPart);
+    return true;
+}
+
+void MappedFile::unmap() {
+    if (m_data) UnmapViewOfFile(m_data);
+    if (m_mappingHandle) CloseHandle(m_mappingHandle);
+    if (m_fileHandle) CloseHandle(m_fileHandle);
+
+    m_data = nullptr;
+    m_size = 0;
+    m_fileHandle = nullptr;
+    m_mappingHandle = nullptr;
+}
+
+static void makeDirectory(const std::string &path) {
+    _mkdir(path.c_str());
+}
+#else
+bool MappedFile::map(const std::string &filename) {
+    unmap();
+
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return false;
+    }
+
+    void *data = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // The mapping keeps the file alive
+    if (data == MAP_FAILED) return false;
+
+    m_data = static_cast<const unsigned char *>(data);
+    m_size = static_cast<size_t>(st.st_size);
+    return true;
+}
+
+void MappedFile::unmap() {
+    if (m_data) munmap(const_cast<unsigned char *>(m_data), m_size);
+
+    m_data = nullptr;
+    m_size = 0;
+}
+
+static void makeDirectory(const std::string &path) {
+    mkdir(path.c_str(), 0755);
+}
+#endif
+
+std::string VolumeCache::filename(uint64_t paramsHash) const {
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.vcld", static_cast<unsigned long long>(paramsHash));
+    return m_directory + name;
+}
+
+bool VolumeCache::load(uint64_t generatorVersion, uint64_t paramsHash, const uint32_t dim[3], GLenum internalFormat,
+                       GLenum format, GLenum type) {
+    if (!m_enabled) return false;
+
+    MappedFile file {};
+    bool hit = file.map(filename(paramsHash)) && file.m_size >= sizeof(VolumeCacheHeader);
+
+    if (hit) {
+        VolumeCacheHeader header;
+        std::memcpy(&header, file.m_data, sizeof(header));
+
+        hit = std::memcmp(header.magic, "VCLD", 4) == 0
+            && header.fileVersion == FILE_VERSION
+            && header.generatorVersion == generatorVersion
+            && header.paramsHash == paramsHash
+            && header.dim[0] == dim[0] && header.dim[1] == dim[1] && header.dim[2] == dim[2]
+            && header.internalFormat == internalFormat
+            && file.m_size >= sizeof(header) + header.dataSize;
+    }
+
+    if (!hit) {
+        m_misses++;
+        return false;
+    }
+
+    // Straight from the mapping, the driver does the only copy
+    const unsigned char *data = file.m_data + sizeof(VolumeCacheHeader);
+    if (isCompressed(internalFormat)) {
+        GLsizei dataSize = static_cast<GLsizei>(file.m_size - sizeof(VolumeCacheHeader));
+        glCompressedTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, dim[0], dim[1], dim[2], internalFormat, dataSize, data);
+    } else {
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, dim[0], dim[1], dim[2], format, type, data);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    }
+
+    m_hits++;
+    return true;
+}
+
+bool VolumeCache::store(uint64_t generatorVersion, uint64_t paramsHash, const uint32_t dim[3], GLenum internalFormat,
+                        GLenum format, GLenum type, size_t texelSize) {
+    if (!m_enabled) return false;
+
+    VolumeCacheHeader header {};
+    std::memcpy(header.magic, "VCLD", 4);
+    header.fileVersion = FILE_VERSION;
+    header.generatorVersion = generatorVersion;
+    header.paramsHash = paramsHash;
+    header.dim[0] = dim[0];
+    header.dim[1] = dim[1];
+    header.dim[2] = dim[2];
+    header.internalFormat = internalFormat;
+
+    std::vector<unsigned char> data {};
+    if (isCompressed(internalFormat)) {
+        GLint compressedSize = 0;
+        glGetTexLevelParameteriv(GL_TEXTURE_3D, 0, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &compressedSize);
+        header.dataSize = static_cast<uint64_t>(compressedSize);
+        data.resize(static_cast<size_t>(header.dataSize));
+        glGetCompressedTexImage(GL_TEXTURE_3D, 0, data.data());
+    } else {
+        header.dataSize = static_cast<uint64_t>(dim[0]) * dim[1] * dim[2] * texelSize;
+        data.resize(static_cast<size_t>(header.dataSize));
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glGetTexImage(GL_TEXTURE_3D, 0, format, type, data.data());
+        glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    }
+
+    makeDirectory(m_directory);
+
+    // Written to a temporary file first, so a concurrent or interrupted run never maps a partial entry
+    std::string path = filename(paramsHash);
+    std::string tmpPath = path + ".tmp";
+    {
+        std::ofstream file(tmpPath.c_str(), std::ios::binary | std::ios::trunc);
+        if (!file.good()) {
+            std::cerr << "ERROR: Cannot write volume cache '" << tmpPath << "'" << std::endl;
+            return false;
+        }
+        file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char *>(data.data()), data.size());
+        if (!file.good()) return false;
+    }
+
+    std::remove(path.c_str()); // rename does not overwrite on Windows
+    return std::rename(tmpPath.c_str(), path.c_str()) == 0;
+}
@@ -0,0 +1,78 @@
+/*
+    volumecache.hpp
+
+    On-disk cache of generated 3D textures. Each entry is a single file: a fixed header followed by the raw texels
+    of the first mip level, loaded with mmap and uploaded straight from the mapping.
+*/
+
+#ifndef VOLUME_CACHE_HPP
+#define VOLUME_CACHE_HPP
+
+#include "gl_includes.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+struct VolumeCacheHeader {
+    char magic[4];             // "VCLD"
+    uint32_t fileVersion;      // Layout of this header
+    uint64_t generatorVersion; // Hash of the generator source, so edits to the shader invalidate the entries
+    uint64_t paramsHash;       // Hash of everything the content depends on
+    uint32_t dim[3];
+    uint32_t internalFormat;   // e.g. GL_R32F
+    uint64_t dataSize;         // Bytes of texel data after the header
+};
+
+// Read-only memory mapping of a whole file, unmapped on destruction
+class MappedFile {
+public:
+    const unsigned char *m_data = nullptr;
+    size_t m_size = 0;
+
+public:
+    MappedFile() = default;
+    ~MappedFile() { unmap(); }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    bool map(const std::string &filename);
+    void unmap();
+
+private:
+#ifdef _WIN32
+    void *m_fileHandle = nullptr;
+    void *m_mappingHandle = nullptr;
+#endif
+};
+
+class VolumeCache {
+public:
+    static const uint32_t FILE_VERSION = 1;
+
+    std::string m_directory = "../cache/";
+    bool m_enabled = true;
+
+    int m_hits = 0;
+    int m_misses = 0;
+
+public:
+    // Uploads the cached volume into level 0 of the bound GL_TEXTURE_3D. Returns false on a miss.
+    // Compressed formats are stored as is, and format, type and texelSize are then ignored.
+    bool load(uint64_t generatorVersion, uint64_t paramsHash, const uint32_t dim[3], GLenum internalFormat,
+              GLenum format, GLenum type);
+
+    // Reads back level 0 of the bound GL_TEXTURE_3D and writes it to the cache
+    bool store(uint64_t generatorVersion, uint64_t paramsHash, const uint32_t dim[3], GLenum internalFormat,
+               GLenum format, GLenum type, size_t texelSize);
+
+    static bool isCompressed(GLenum internalFormat) {
+        return internalFormat == GL_COMPRESSED_RED_RGTC1;
+    }
+
+private:
+    std::string filename(uint64_t paramsHash) const;
+};
+
+#endif // VOLUME_CACHE_HPP
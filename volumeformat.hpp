@@ -0,0 +1,113 @@
+#ifndef VOLUME_FORMAT_HPP
+#define VOLUME_FORMAT_HPP
+
+#include "gl_includes.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Storage format of the density volume. The density is clamped to [0, 1] by the generator,
+// so the smaller formats only lose precision, not range.
+enum VolumeFormat {
+    VOLUME_R32F = 0,
+    VOLUME_R16F = 1,
+    VOLUME_R8 = 2,   // UNORM
+    VOLUME_BC4 = 3,  // RGTC1, encoded on the CPU from a R32F staging volume
+    NUM_VOLUME_FORMATS = 4,
+};
+
+struct VolumeFormatInfo {
+    const char *name;
+    GLenum internalFormat;
+    GLenum imageFormat;   // Format of the image the compute shader writes to
+    GLenum pixelType;     // Native client type of a texel, GL_NONE if compressed
+    float bytesPerVoxel;
+};
+
+inline const VolumeFormatInfo &volumeFormatInfo(int format) {
+    static const VolumeFormatInfo formats[NUM_VOLUME_FORMATS] = {
+        { "r32f", GL_R32F, GL_R32F, GL_FLOAT, 4.0f },
+        { "r16f", GL_R16F, GL_R16F, GL_HALF_FLOAT, 2.0f },
+        { "r8", GL_R8, GL_R8, GL_UNSIGNED_BYTE, 1.0f },
+        { "bc4", GL_COMPRESSED_RED_RGTC1, GL_R32F, GL_NONE, 0.5f }, // 8 bytes per 4x4 block
+    };
+    return formats[format];
+}
+
+// Returns -1 if the name is unknown
+inline int volumeFormatFromName(const std::string &name) {
+    for (int i = 0; i < NUM_VOLUME_FORMATS; i++) {
+        if (name == volumeFormatInfo(i).name) return i;
+    }
+    return -1;
+}
+
+// BC4 (RGTC1) encoder. A 3D RGTC texture is a stack of 2D compressed slices, so each Z-slice is encoded
+// independently in 4x4 blocks of the XY plane, rows of blocks first, as expected by glCompressedTexSubImage3D.
+class Bc4Encoder {
+public:
+    static size_t sliceSize(int dimX, int dimY) {
+        return static_cast<size_t>((dimX + 3) / 4) * ((dimY + 3) / 4) * 8;
+    }
+
+    // Encodes the slices [firstZ, firstZ + numZ) of a float volume, x first, then y, then z
+    static void encode(const float *volume, int dimX, int dimY, int firstZ, int numZ, std::vector<unsigned char> &blocks) {
+        blocks.resize(sliceSize(dimX, dimY) * numZ);
+        unsigned char *out = blocks.data();
+
+        for (int z = firstZ; z < firstZ + numZ; z++) {
+            const float *slice = volume + static_cast<size_t>(z) * dimX * dimY;
+
+            for (int by = 0; by < dimY; by += 4) {
+                for (int bx = 0; bx < dimX; bx += 4) {
+                    float texels[16];
+                    for (int j = 0; j < 4; j++) {
+                        for (int i = 0; i < 4; i++) { // The border blocks repeat the last row and column
+                            int x = std::min(bx + i, dimX - 1);
+                            int y = std::min(by + j, dimY - 1);
+                            texels[j * 4 + i] = slice[y * dimX + x];
+                        }
+                    }
+                    encodeBlock(texels, out);
+                    out += 8;
+                }
+            }
+        }
+    }
+
+private:
+    static unsigned char toUnorm8(float value) {
+        return static_cast<unsigned char>(std::min(std::max(value, 0.0f), 1.0f) * 255.0f + 0.5f);
+    }
+
+    // Eight-value mode only (red0 > red1): the endpoints are the extremes of the block
+    static void encodeBlock(const float texels[16], unsigned char block[8]) {
+        unsigned char red0 = 0, red1 = 255;
+        for (int i = 0; i < 16; i++) {
+            red0 = std::max(red0, toUnorm8(texels[i]));
+            red1 = std::min(red1, toUnorm8(texels[i]));
+        }
+
+        uint64_t indices = 0;
+        if (red0 > red1) {
+            float scale = 7.0f / (red0 - red1);
+            for (int i = 0; i < 16; i++) {
+                // Position between red0 (0) and red1 (7), then remapped to the index order of the format:
+                // 0 is red0, 1 is red1, 2 to 7 are the interpolated values from red0 to red1
+                float t = (red0 - std::min(std::max(texels[i], 0.0f), 1.0f) * 255.0f) * scale;
+                int position = std::min(std::max(static_cast<int>(t + 0.5f), 0), 7);
+                uint64_t index = position == 0 ? 0 : position == 7 ? 1 : position + 1;
+                indices |= index << (3 * i);
+            }
+        }
+        // else: uniform block, every index 0 is red0
+
+        block[0] = red0;
+        block[1] = red1;
+        for (int i = 0; i < 6; i++) block[2 + i] = static_cast<unsigned char>(indices >> (8 * i));
+    }
+};
+
+#endif // VOLUME_FORMAT_HPP
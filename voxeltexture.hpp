@@ -2,58 +2,870 @@
 #define VOXEL_TEXTURE_HPP
 
 #include "gl_includes.hpp"
+#include "hash.hpp"
 #include "shader.hpp"
+#include "shadermanager.hpp"
+#include "CloudsManager.hpp"
+#include "noisetextures.hpp"
+#include "cpugenerator.hpp"
+#include "volumecache.hpp"
+#include "volumeformat.hpp"
+#include "occupancygrid.hpp"
+#include "lighttransmittance.hpp"
 
+#include "imgui.h"
+
+#include <cstring>
+#include <iostream>
+#include <utility>
+#include <vector>
+
+enum GenerationMode {
+    GENERATION_FULL = 0,         // The whole volume is regenerated in a single dispatch
+    GENERATION_SLICED = 1,       // Animation updates are spread over several frames into a back buffer, then swapped
+    GENERATION_INTERPOLATED = 2, // Two keyframes are blended at render time, the next one is generated in slices
+    GENERATION_CPU = 3,          // Generated by the multi-threaded CPU port of the simplex path, then uploaded
+};
+
+// Density volume generated by the compute shader.
+// The program and the texture storage are created once in init(), and the volume is only regenerated
+// when the generation parameters change, or when the animation time moved forward by more than 1 / m_updateRate.
+// In sliced mode, animation updates write a few Z-slabs per frame into a back texture, within a GPU time budget,
+// and textureID is swapped with it once all the slabs are done. Parameter changes are always applied immediately.
+// In interpolated mode, textureID and nextTextureID() hold the keyframes at m_keyTimes[0] and m_keyTimes[1],
+// blended by keyframeBlend() in the lighting pass, while the following keyframe is generated in slices in the back texture.
+// When the animation is paused, full generations go through the on-disk cache: a hit replaces the dispatch by an upload,
+// and a miss is written to the cache once the parameters stayed unchanged for STORE_DELAY updates.
+// The volumes are stored in m_format. In BC4, the compute shader writes to a R32F staging texture, whose dispatched
+// Z-range is copied to a pixel pack buffer and compressed on the CPU a few frames later, once its fence is signaled:
+// meant for paused or slowly animated volumes, not for every-frame generation.
+// Each volume has its own occupancy grid, rebuilt whenever the volume is complete, which moves with it when they are swapped.
+// It also has its own light transmittance volume and cloud shadow map, baked lazily for the displayed volumes by updateTransmittance(),
+// when the volume was regenerated or the directional lights moved.
+// The volumes have MIP_LEVELS mipmap levels, regenerated whenever a volume is complete, for the distance-based LOD of the raymarcher.
 class VoxelTexture {
 public:
-    GLuint textureID {};
+    static const int SLAB_DEPTH = 8; // Z-depth of a slab, one work group
+    static const int MIP_LEVELS = 4; // Down to 32 x 4 x 32, every level is still made of whole BC4 blocks
+    static const int STORE_DELAY = 30; // Not every step of a slider drag is worth a file
+
+    GLuint textureID {}; // Front texture, the one to render
     GLuint shaderID {};
-    
+
     GLuint dimXZ {};
     GLuint dimY {};
 
+    bool m_animate = true;
+    float m_presetTime = -1.0f; // Fixed weather: generation time used instead of the clock, negative to follow the clock
+    float m_updateRate = 0.0f; // Regenerations per second when animated, 0 to regenerate every frame
+
+    int m_mode = GENERATION_FULL;
+    int m_format = VOLUME_R32F; // VolumeFormat, applied at the next update
+    float m_sliceBudgetMs = 1.0f; // GPU time spent per frame on a sliced generation
+    float m_keyframeRate = 2.0f;  // Keyframes per second in interpolated mode
+
+    float m_lastGenerationMs = 0.0f; // GPU time of the last timed dispatch
+    float m_msPerSlab = 0.0f;        // Running estimate of the GPU time of one slab
+    float m_lastCpuGenerationMs = 0.0f;
+    float m_lastEncodeMs = 0.0f;  // BC4 compression of the last completed range, and of the mips if it completed a volume
+    float m_frameEncodeMs = 0.0f; // The same, summed over the ranges completed by the last update
+    int m_numGenerations = 0;
+
+    float m_validationMaxError = -1.0f; // Difference between the CPU and GPU volumes, negative until validated
+    float m_validationMeanError = 0.0f;
+
+    bool m_emptySpaceSkipping = true;
+    bool m_bakedTransmittance = true; // Directional lights use the transmittance volumes instead of a light march
+
+    NoiseTextures m_noise {};
+    VolumeCache m_cache {};
+
+private:
+    GLuint m_nextTexture {};
+    GLuint m_backTexture {};
+    GLuint m_stagingTexture {}; // R32F output of the compute shader, only in BC4
+    int m_allocatedFormat = VOLUME_R32F;
+    std::vector<unsigned char> m_blocks {};
+
+    // BC4 readbacks in flight, in dispatch order
+    struct Readback {
+        GLuint buffer;
+        GLsync fence;
+        GLuint texture;
+        int firstZ;
+        int numZ;
+        bool completes; // The range is the last one of the volume
+    };
+    std::vector<Readback> m_readbacks {};
+    std::vector<GLuint> m_freeBuffers {}; // Pixel pack buffers of completed readbacks, all of the size of a full volume
+    GLuint m_readFramebuffer {};
+
+    OccupancyGrid m_occupancyGrid {};
+    GLuint m_volumes[3] {}; // The textures behind textureID, m_nextTexture and m_backTexture, in any order
+    GLuint m_grids[3] {};   // Occupancy grid of each of m_volumes
+
+    LightTransmittance m_lightTransmittance {};
+    GLuint m_transmittances[3] {};        // Light transmittance volume of each of m_volumes
+    GLuint m_shadowMaps[3] {};            // Top-down cloud shadow map of each of m_volumes
+    uint64_t m_transmittanceKeys[3] {};   // Lights each one was baked for, 0 when out of date
+
+    GLuint m_timerQueries[2] {}; // Timestamps before and after the dispatch
+    bool m_timerPending = false;
+    int m_timedSlabs = 0;
+
+    bool m_generated = false;
+    GenerationParams m_generatedParams {}; // Parameters and time of the latest requested generation
+    float m_generatedTime = 0.0f;
+    float m_lastTime = 0.0f; // Time of the last update, kept when the animation is paused
+
+    bool m_sliceActive = false; // A sliced generation is in progress in the back texture
+    int m_nextSlab = 0;
+    float m_sliceTime = 0.0f;
+
+    std::vector<float> m_cpuVolume {};
+    std::vector<float> m_mipVolumes[2] {}; // Previous and current level of a compressed mip chain
+    std::vector<float> m_levelZero[3] {};  // BC4 only: uncompressed level 0 of each of m_volumes, filled by the readbacks
+
+    uint64_t m_generatorVersion = 0; // Hash of compute.glsl and its includes
+    int m_pendingStore = 0;          // Updates left before textureID is written to the cache, 0 if nothing to write
+    uint64_t m_pendingKey = 0;
+    uint64_t m_cachedKey = 0;        // Key of the content of textureID, once it was loaded from or written to the cache
+
+    bool m_keyframesValid = false;
+    float m_keyTimes[2] {};
+    float m_blend = 0.0f;
+
 public:
     VoxelTexture() {
         dimXZ = 256;
         dimY = 32;
     }
 
-    void generateTexture(glm::vec3 targetSize, glm::vec3 targetOffest) {
-        //std::cout << "Generating voxel texture..." << std::endl;
+    ~VoxelTexture() {
+        release();
+    }
 
-        if (shaderID) glDeleteProgram(shaderID);
+    // Deletes every GL object, while the context is still alive. The destructor does nothing after it.
+    void release() {
+        ShaderManager::instance().destroy(shaderID);
+        shaderID = 0;
+        releaseVolumes();
+        if (m_timerQueries[0]) glDeleteQueries(2, m_timerQueries);
+        m_timerQueries[0] = m_timerQueries[1] = 0;
 
-        shaderID = glCreateProgram();
-        
-        loadShader(shaderID, GL_COMPUTE_SHADER, "../resources/compute.glsl");
+        m_noise.release();
+        m_occupancyGrid.release();
+        m_lightTransmittance.release();
+    }
 
-        glLinkProgram(shaderID);
+    void init() {
+        // Also called when compute.glsl is edited: the cached volumes of the previous version no longer match
+        shaderID = ShaderManager::instance().createCompute("../resources/compute.glsl", [this](GLuint program) {
+            glUseProgram(program);
+            setUniform(program, "u_resolution", glm::vec3(dimXZ, dimY, dimXZ));
+            setUniform(program, "u_baseNoise", 0);
+            setUniform(program, "u_detailNoise", 1);
+            glUseProgram(0);
 
-        glUseProgram(shaderID);
+            std::string source = loadShaderSource("../resources/compute.glsl");
+            m_generatorVersion = hashBytes(source.data(), source.size());
+            m_generated = false;
+            m_keyframesValid = false;
+            m_sliceActive = false;
+            m_pendingStore = 0;
+        });
 
-        if (!textureID) {
-            glGenTextures(1, &textureID);
+        m_noise.bake(m_cache);
+        m_occupancyGrid.init();
+        m_lightTransmittance.init();
+
+        allocateVolumes();
+
+        glGenQueries(2, m_timerQueries);
+    }
+
+    int numSlabs() const {
+        return dimXZ / SLAB_DEPTH;
+    }
+
+    // Second keyframe, to blend with textureID by keyframeBlend()
+    GLuint nextTextureID() const {
+        return m_mode == GENERATION_INTERPOLATED ? m_nextTexture : textureID;
+    }
+
+    float keyframeBlend() const {
+        return m_mode == GENERATION_INTERPOLATED ? m_blend : 0.0f;
+    }
+
+    GLuint occupancyTextureID() const {
+        return occupancyOf(textureID);
+    }
+
+    GLuint nextOccupancyTextureID() const {
+        return occupancyOf(nextTextureID());
+    }
+
+    GLuint transmittanceTextureID() const {
+        return m_transmittances[volumeIndex(textureID)];
+    }
+
+    GLuint nextTransmittanceTextureID() const {
+        return m_transmittances[volumeIndex(nextTextureID())];
+    }
+
+    GLuint shadowMapID() const {
+        return m_shadowMaps[volumeIndex(textureID)];
+    }
+
+    GLuint nextShadowMapID() const {
+        return m_shadowMaps[volumeIndex(nextTextureID())];
+    }
+
+    // Bakes the transmittance and the shadow map of the displayed volumes toward the directional lights, if out of date
+    void updateTransmittance(const glm::vec3 *directions, int numLights) {
+        if (!m_bakedTransmittance) return;
+
+        uint64_t key = hashBytes(&numLights, sizeof(numLights), hashBytes(directions, numLights * sizeof(glm::vec3)));
+        if (key == 0) key = 1; // 0 means out of date
+
+        GLuint visible[2] = { textureID, nextTextureID() };
+        for (GLuint texture : visible) {
+            int i = volumeIndex(texture);
+            if (m_transmittanceKeys[i] == key) continue;
+
+            m_lightTransmittance.bake(texture, m_transmittances[i], m_shadowMaps[i], dimXZ, dimY, dimXZ,
+                                      m_generatedParams.domainSize, directions, numLights);
+            m_transmittanceKeys[i] = key;
+        }
+    }
+
+    // Occupancy levels the raymarcher may use, 0 to disable empty-space skipping
+    int occupancyLevels() const {
+        return m_emptySpaceSkipping ? OccupancyGrid::NUM_LEVELS : 0;
+    }
+
+    // GPU memory of the volumes, in bytes
+    size_t memoryUsage() const {
+        size_t numVoxels = static_cast<size_t>(dimXZ) * dimY * dimXZ;
+        size_t mipVoxels = 0;
+        for (int level = 0; level < MIP_LEVELS; level++) {
+            mipVoxels += static_cast<size_t>(dimXZ >> level) * (dimY >> level) * (dimXZ >> level);
+        }
+        size_t bytes = 3 * static_cast<size_t>(mipVoxels * volumeFormatInfo(m_allocatedFormat).bytesPerVoxel);
+        if (m_stagingTexture) bytes += numVoxels * sizeof(float);
+        bytes += (m_readbacks.size() + m_freeBuffers.size()) * numVoxels * sizeof(float); // Readback buffers
+        return bytes;
+    }
+
+    // Regenerates the volume if needed. Returns true if anything was dispatched.
+    bool update(const GenerationParams &params, float time) {
+        readTimer();
+        m_frameEncodeMs = 0.0f;
+        finishReadbacks(false);
+
+        if (m_format != m_allocatedFormat) allocateVolumes();
+
+        // With a fixed weather, the volume is the same on every run, so it comes from the cache after the first one.
+        // Paused, it is frozen at the time of the last update.
+        bool frozen = !m_animate || m_presetTime >= 0.0f;
+        if (m_presetTime >= 0.0f) time = m_presetTime;
+        else if (!m_animate) time = m_lastTime;
+        m_lastTime = time;
+
+        bool paramsChanged = !m_generated
+            || params.domainCenter != m_generatedParams.domainCenter
+            || params.domainSize != m_generatedParams.domainSize
+            || params.useNoiseTextures != m_generatedParams.useNoiseTextures;
+
+        bool timeChanged = m_animate && time != m_generatedTime
+            && (m_updateRate <= 0.0f || time - m_generatedTime >= 1.0f / m_updateRate || time < m_generatedTime);
+
+        if (!frozen || m_mode == GENERATION_INTERPOLATED) m_pendingStore = 0;
+
+        if (m_mode == GENERATION_INTERPOLATED) return updateKeyframes(params, time, paramsChanged);
+        m_keyframesValid = false;
+
+        if (paramsChanged || (timeChanged && (m_mode == GENERATION_FULL || m_mode == GENERATION_CPU))) {
+            setGenerated(params, time);
+            m_sliceActive = false;
+            m_pendingStore = 0;
+
+            uint64_t key = cacheKey(params, time);
+            if (frozen && loadFromCache(key)) return false;
+
+            if (m_mode == GENERATION_CPU) generateOnCpu(textureID, params, time);
+            else dispatch(textureID, params, time, 0, numSlabs());
+            m_numGenerations++;
+
+            if (frozen) {
+                m_pendingStore = STORE_DELAY;
+                m_pendingKey = key;
+            }
+            return true;
+        }
+
+        if (m_pendingStore > 0 && --m_pendingStore == 0) storeToCache(m_pendingKey);
+
+        // Pausing regenerates nothing: the volume displayed when the animation stopped is stored as it is
+        if (frozen && m_generated && !m_sliceActive && m_pendingStore == 0) {
+            uint64_t key = cacheKey(m_generatedParams, m_generatedTime);
+            if (key != m_cachedKey) {
+                m_pendingStore = STORE_DELAY;
+                m_pendingKey = key;
+            }
+        }
+
+        if (timeChanged && !m_sliceActive) { // The time of an in-progress sliced generation stays fixed until it is done
+            setGenerated(params, time);
+            startSlices(time);
+        }
+
+        if (!m_sliceActive) return false;
+
+        if (generateSlabs()) std::swap(textureID, m_backTexture);
+
+        return true;
+    }
+
+    void renderUI() {
+        ImGui::Begin("Generation", nullptr, ImGuiWindowFlags_AlwaysAutoResize);
+
+        ImGui::Checkbox("Animate", &m_animate);
+        bool fixedWeather = m_presetTime >= 0.0f;
+        if (ImGui::Checkbox("Fixed weather", &fixedWeather)) m_presetTime = fixedWeather ? m_lastTime : -1.0f;
+        if (fixedWeather) ImGui::SliderFloat("Weather time (s)", &m_presetTime, 0.0f, 600.0f);
+        ImGui::SliderFloat("Update rate (Hz)", &m_updateRate, 0.0f, 60.0f);
+
+        const char* modes[] = { "Full", "Time-sliced", "Interpolated", "CPU" };
+        ImGui::Combo("Mode", &m_mode, modes, IM_ARRAYSIZE(modes));
+
+        const char* formats[] = { "R32F", "R16F", "R8", "BC4" };
+        ImGui::Combo("Format", &m_format, formats, IM_ARRAYSIZE(formats));
+        ImGui::Text("Volume memory: %.2f MiB", memoryUsage() / (1024.0 * 1024.0));
+        ImGui::Checkbox("Empty-space skipping", &m_emptySpaceSkipping);
+        ImGui::Checkbox("Baked light transmittance", &m_bakedTransmittance);
+        if (m_allocatedFormat == VOLUME_BC4) ImGui::Text("BC4 readback and encoding: %.1f ms", m_lastEncodeMs);
+        if (m_mode == GENERATION_CPU) {
+            ImGui::Text("CPU generation: %.1f ms (%s)", m_lastCpuGenerationMs, CpuGenerator::instructionSet().c_str());
+        }
+        if (m_mode == GENERATION_INTERPOLATED) {
+            ImGui::SliderFloat("Keyframe rate (Hz)", &m_keyframeRate, 0.5f, 10.0f);
+            ImGui::Text("Blend: %.2f", m_blend);
+        }
+        if (m_mode != GENERATION_FULL) {
+            ImGui::SliderFloat("Slice budget (ms)", &m_sliceBudgetMs, 0.1f, 10.0f);
+            ImGui::Text("Slab cost: %.3f ms (%d slabs)", m_msPerSlab, numSlabs());
+            if (m_sliceActive) ImGui::ProgressBar(static_cast<float>(m_nextSlab) / numSlabs());
+        }
+
+        ImGui::Text("Resolution: %u x %u x %u", dimXZ, dimY, dimXZ);
+        ImGui::Text("Last dispatch: %.3f ms (GPU)", m_lastGenerationMs);
+        ImGui::Text("Generations: %d", m_numGenerations);
+
+        ImGui::Checkbox("Disk cache (paused or fixed weather)", &m_cache.m_enabled);
+        ImGui::Text("Cache hits: %d, misses: %d", m_cache.m_hits, m_cache.m_misses);
+
+        if (ImGui::Button("Validate CPU against GPU")) validateCpu(m_generatedParams, m_generatedTime);
+        if (m_validationMaxError >= 0.0f) {
+            ImGui::Text("Max error: %.6f, mean error: %.6f", m_validationMaxError, m_validationMeanError);
         }
 
-        setUniform(shaderID, "u_resolution", glm::vec3(dimXZ, dimY, dimXZ));
-        setUniform(shaderID, "u_targetSize", targetSize);
-        setUniform(shaderID, "u_targetOffset", targetOffest);
-        setUniform(shaderID, "u_time", (float)glfwGetTime());
+        ImGui::End();
+    }
+
+    // Generates the simplex path on the GPU and on the CPU, and compares the two volumes.
+    // Uses the back texture, which must not hold an in-progress sliced generation.
+    void validateCpu(GenerationParams params, float time) {
+        params.useNoiseTextures = false; // The CPU generator only implements the simplex path
+        m_sliceActive = false;
+        m_keyframesValid = false;
+
+        dispatch(m_backTexture, params, time, 0, numSlabs());
+        finishReadbacks(true);
+
+        std::vector<float> gpuVolume(static_cast<size_t>(dimXZ) * dimY * dimXZ);
+        glBindTexture(GL_TEXTURE_3D, m_backTexture);
+        glGetTexImage(GL_TEXTURE_3D, 0, GL_RED, GL_FLOAT, gpuVolume.data());
+        glBindTexture(GL_TEXTURE_3D, 0);
+
+        CpuGenerator::generate(cpuParams(params, time), m_cpuVolume);
+        CpuGenerator::compare(m_cpuVolume, gpuVolume, m_validationMaxError, m_validationMeanError);
+
+        std::cout << "CPU / GPU volume difference: max " << m_validationMaxError << ", mean " << m_validationMeanError << std::endl;
+    }
+
+    CpuGeneratorParams cpuParams(const GenerationParams &params, float time) const {
+        CpuGeneratorParams cpu {};
+        cpu.dimX = dimXZ;
+        cpu.dimY = dimY;
+        cpu.dimZ = dimXZ;
+        for (int i = 0; i < 3; i++) {
+            cpu.targetSize[i] = params.domainSize[i];
+            cpu.targetOffset[i] = params.domainCenter[i];
+        }
+        cpu.time = time;
+        return cpu;
+    }
+
+private:
+    void setGenerated(const GenerationParams &params, float time) {
+        m_generated = true;
+        m_generatedParams = params;
+        m_generatedTime = time;
+    }
 
+    // Everything the content of a full generation depends on, besides the generator source
+    uint64_t cacheKey(const GenerationParams &params, float time) const {
+        const float values[7] = {
+            params.domainCenter.x, params.domainCenter.y, params.domainCenter.z,
+            params.domainSize.x, params.domainSize.y, params.domainSize.z,
+            time
+        };
+        const int flags[3] = { params.useNoiseTextures, m_mode == GENERATION_CPU, m_allocatedFormat };
+
+        uint64_t hash = hashBytes(values, sizeof(values));
+        return hashBytes(flags, sizeof(flags), hash);
+    }
+
+    bool loadFromCache(uint64_t key) {
+        finishReadbacks(true); // A late readback would overwrite the loaded volume
+
+        const VolumeFormatInfo &format = volumeFormatInfo(m_allocatedFormat);
+        const uint32_t dim[3] = { dimXZ, dimY, dimXZ };
+        glBindTexture(GL_TEXTURE_3D, textureID);
+        bool hit = m_cache.load(m_generatorVersion, key, dim, format.internalFormat, GL_RED, format.pixelType);
+        glBindTexture(GL_TEXTURE_3D, 0);
+
+        if (hit) {
+            volumeCompleted(textureID);
+            m_cachedKey = key;
+        }
+        return hit;
+    }
+
+    void storeToCache(uint64_t key) {
+        finishReadbacks(true);
+
+        const VolumeFormatInfo &format = volumeFormatInfo(m_allocatedFormat);
+        const uint32_t dim[3] = { dimXZ, dimY, dimXZ };
         glBindTexture(GL_TEXTURE_3D, textureID);
+        m_cache.store(m_generatorVersion, key, dim, format.internalFormat, GL_RED, format.pixelType,
+                      static_cast<size_t>(format.bytesPerVoxel));
+        glBindTexture(GL_TEXTURE_3D, 0);
+        m_cachedKey = key; // Not retried if the write failed
+    }
+
+    // (Re)creates the volumes in m_format, which then all have to be regenerated.
+    // Falls back to R8 if the driver does not support 3D RGTC textures.
+    void allocateVolumes() {
+        releaseVolumes();
+
+        textureID = createVolume(volumeFormatInfo(m_format).internalFormat, MIP_LEVELS);
+        if (!textureID) {
+            std::cerr << "WARNING: " << volumeFormatInfo(m_format).name << " 3D textures are not supported, using r8" << std::endl;
+            m_format = VOLUME_R8;
+            textureID = createVolume(volumeFormatInfo(m_format).internalFormat, MIP_LEVELS);
+        }
+        m_nextTexture = createVolume(volumeFormatInfo(m_format).internalFormat, MIP_LEVELS);
+        m_backTexture = createVolume(volumeFormatInfo(m_format).internalFormat, MIP_LEVELS);
+        if (m_format == VOLUME_BC4) m_stagingTexture = createVolume(GL_R32F, 1);
+
+        m_volumes[0] = textureID;
+        m_volumes[1] = m_nextTexture;
+        m_volumes[2] = m_backTexture;
+        for (int i = 0; i < 3; i++) {
+            m_grids[i] = OccupancyGrid::create(dimXZ, dimY, dimXZ);
+            m_transmittances[i] = LightTransmittance::create(dimXZ, dimY, dimXZ);
+            m_shadowMaps[i] = LightTransmittance::createShadowMap(dimXZ, dimXZ);
+            m_transmittanceKeys[i] = 0;
+        }
+
+        m_allocatedFormat = m_format;
+        m_generated = false;
+        m_keyframesValid = false;
+        m_sliceActive = false;
+        m_pendingStore = 0;
+    }
+
+    void releaseVolumes() {
+        releaseReadbacks();
+        for (std::vector<float> &levelZero : m_levelZero) std::vector<float>().swap(levelZero);
+
+        GLuint *textures[] = { &textureID, &m_nextTexture, &m_backTexture, &m_stagingTexture };
+        for (GLuint *texture : textures) {
+            if (*texture) glDeleteTextures(1, texture);
+            *texture = 0;
+        }
+
+        for (int i = 0; i < 3; i++) {
+            if (m_grids[i]) glDeleteTextures(1, &m_grids[i]);
+            if (m_transmittances[i]) glDeleteTextures(1, &m_transmittances[i]);
+            if (m_shadowMaps[i]) glDeleteTextures(1, &m_shadowMaps[i]);
+            m_grids[i] = 0;
+            m_transmittances[i] = 0;
+            m_shadowMaps[i] = 0;
+            m_volumes[i] = 0;
+        }
+    }
+
+    int volumeIndex(GLuint texture) const {
+        for (int i = 0; i < 3; i++) {
+            if (m_volumes[i] == texture) return i;
+        }
+        return 0;
+    }
+
+    GLuint occupancyOf(GLuint texture) const {
+        return m_grids[volumeIndex(texture)];
+    }
+
+    // To call whenever the whole content of texture is ready. In BC4, levelZero is its uncompressed level 0 if known.
+    void volumeCompleted(GLuint texture, const float *levelZero = nullptr) {
+        generateMips(texture, levelZero);
+        m_occupancyGrid.build(texture, occupancyOf(texture), dimXZ, dimY, dimXZ);
+        m_transmittanceKeys[volumeIndex(texture)] = 0;
+    }
+
+    // Immutable storage, allocated once per format. Returns 0 if the format is not supported.
+    GLuint createVolume(GLenum internalFormat, int levels) {
+        while (glGetError() != GL_NO_ERROR) {}
+
+        GLuint texture {};
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_3D, texture);
+        glTexStorage3D(GL_TEXTURE_3D, levels, internalFormat, dimXZ, dimY, dimXZ);
         glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+        glBindTexture(GL_TEXTURE_3D, 0);
+
+        if (glGetError() != GL_NO_ERROR) {
+            glDeleteTextures(1, &texture);
+            return 0;
+        }
+        return texture;
+    }
+
+    // Compresses the Z-slices [firstZ, firstZ + numZ) of a float volume into the BC4 texture
+    void uploadCompressed(GLuint texture, const float *volume, int firstZ, int numZ) {
+        Bc4Encoder::encode(volume, dimXZ, dimY, firstZ, numZ, m_blocks);
+
+        glBindTexture(GL_TEXTURE_3D, texture);
+        glCompressedTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, firstZ, dimXZ, dimY, numZ, GL_COMPRESSED_RED_RGTC1,
+                                  static_cast<GLsizei>(m_blocks.size()), m_blocks.data());
+        glBindTexture(GL_TEXTURE_3D, 0);
+    }
+
+    // Rebuilds the mip levels of texture from its level 0
+    void generateMips(GLuint texture, const float *levelZero) {
+        if (m_allocatedFormat != VOLUME_BC4) {
+            glBindTexture(GL_TEXTURE_3D, texture);
+            glGenerateMipmap(GL_TEXTURE_3D);
+            glBindTexture(GL_TEXTURE_3D, 0);
+            return;
+        }
+
+        // Compressed formats cannot be rendered to, so glGenerateMipmap does not support them:
+        // the levels are box-filtered on the CPU from the uncompressed level 0, then encoded.
+        // Without it (a volume loaded from the cache), from the decoded level 0, which waits for the GPU.
+        int dimX = dimXZ, dimYLevel = dimY, dimZ = dimXZ;
 
-        glTexImage3D(GL_TEXTURE_3D, 0, GL_R32F, dimXZ, dimY, dimXZ, 0, GL_RED, GL_FLOAT, nullptr);
+        glBindTexture(GL_TEXTURE_3D, texture);
+        if (!levelZero) {
+            m_mipVolumes[0].resize(static_cast<size_t>(dimX) * dimYLevel * dimZ);
+            glGetTexImage(GL_TEXTURE_3D, 0, GL_RED, GL_FLOAT, m_mipVolumes[0].data());
+        }
+
+        for (int level = 1; level < MIP_LEVELS; level++) {
+            downsample(level == 1 && levelZero ? levelZero : m_mipVolumes[0].data(), dimX, dimYLevel, dimZ, m_mipVolumes[1]);
+            dimX /= 2;
+            dimYLevel /= 2;
+            dimZ /= 2;
+
+            Bc4Encoder::encode(m_mipVolumes[1].data(), dimX, dimYLevel, 0, dimZ, m_blocks);
+            glCompressedTexSubImage3D(GL_TEXTURE_3D, level, 0, 0, 0, dimX, dimYLevel, dimZ, GL_COMPRESSED_RED_RGTC1,
+                                      static_cast<GLsizei>(m_blocks.size()), m_blocks.data());
+
+            std::swap(m_mipVolumes[0], m_mipVolumes[1]);
+        }
 
-        glBindImageTexture(0, textureID, 0, GL_TRUE, 0, GL_WRITE_ONLY, GL_R32F);
-        glDispatchCompute(dimXZ/8, dimY/8, dimXZ/8);
-        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
-        glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
         glBindTexture(GL_TEXTURE_3D, 0);
+    }
+
+    // Averages the 2x2x2 voxels of a volume with even dimensions
+    static void downsample(const float *volume, int dimX, int dimY, int dimZ, std::vector<float> &result) {
+        int halfX = dimX / 2, halfY = dimY / 2, halfZ = dimZ / 2;
+        result.resize(static_cast<size_t>(halfX) * halfY * halfZ);
+
+        for (int z = 0; z < halfZ; z++) {
+            for (int y = 0; y < halfY; y++) {
+                for (int x = 0; x < halfX; x++) {
+                    float sum = 0.0f;
+                    for (int i = 0; i < 8; i++) {
+                        int sx = 2 * x + (i & 1), sy = 2 * y + ((i >> 1) & 1), sz = 2 * z + (i >> 2);
+                        sum += volume[(static_cast<size_t>(sz) * dimY + sy) * dimX + sx];
+                    }
+                    result[(static_cast<size_t>(z) * halfY + y) * halfX + x] = sum * 0.125f;
+                }
+            }
+        }
+    }
+
+    void generateOnCpu(GLuint texture, const GenerationParams &params, float time) {
+        double start = glfwGetTime();
+        CpuGenerator::generate(cpuParams(params, time), m_cpuVolume);
+        m_lastCpuGenerationMs = static_cast<float>((glfwGetTime() - start) * 1000.0);
+
+        if (m_allocatedFormat == VOLUME_BC4) {
+            finishReadbacks(true); // Older GPU ranges of the texture must not land over this one
+
+            start = glfwGetTime();
+            uploadCompressed(texture, m_cpuVolume.data(), 0, dimXZ);
+            volumeCompleted(texture, m_cpuVolume.data());
+            m_lastEncodeMs = static_cast<float>((glfwGetTime() - start) * 1000.0);
+            m_frameEncodeMs += m_lastEncodeMs;
+            return;
+        }
+
+        glBindTexture(GL_TEXTURE_3D, texture);
+        glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, dimXZ, dimY, dimXZ, GL_RED, GL_FLOAT, m_cpuVolume.data());
+        glBindTexture(GL_TEXTURE_3D, 0);
+
+        volumeCompleted(texture);
+    }
+
+    // Keyframe animation: keeps m_keyTimes[0] <= time < m_keyTimes[1], and rotates the textures when time reaches the second keyframe
+    bool updateKeyframes(const GenerationParams &params, float time, bool paramsChanged) {
+        float interval = 1.0f / m_keyframeRate;
+
+        bool restart = paramsChanged || !m_keyframesValid
+            || time < m_keyTimes[0] || time >= m_keyTimes[1] + interval; // Time jumped, the back keyframe is useless
+
+        if (restart) {
+            setGenerated(params, time);
+
+            m_keyTimes[0] = time;
+            m_keyTimes[1] = time + interval;
+            dispatch(textureID, params, m_keyTimes[0], 0, numSlabs());
+            dispatch(m_nextTexture, params, m_keyTimes[1], 0, numSlabs());
+            finishReadbacks(true); // Both keyframes are displayed from now on
+            m_numGenerations += 2;
+            m_keyframesValid = true;
+
+            startSlices(m_keyTimes[1] + interval);
+        } else if (time >= m_keyTimes[1]) {
+            // The next keyframe is needed now: finish it at once if the budget was too small
+            if (m_sliceActive) {
+                if (m_nextSlab < numSlabs()) dispatch(m_backTexture, m_generatedParams, m_sliceTime, m_nextSlab, numSlabs() - m_nextSlab);
+                m_sliceActive = false;
+                m_numGenerations++;
+            }
+            finishReadbacks(true);
+
+            GLuint previous = textureID;
+            textureID = m_nextTexture;
+            m_nextTexture = m_backTexture;
+            m_backTexture = previous;
+
+            m_keyTimes[0] = m_keyTimes[1];
+            m_keyTimes[1] += interval;
+
+            startSlices(m_keyTimes[1] + interval);
+        }
+
+        if (m_sliceActive) generateSlabs();
+
+        m_blend = glm::clamp((time - m_keyTimes[0]) / (m_keyTimes[1] - m_keyTimes[0]), 0.0f, 1.0f);
+
+        return true;
+    }
+
+    void startSlices(float time) {
+        m_sliceActive = true;
+        m_nextSlab = 0;
+        m_sliceTime = time;
+    }
+
+    // Continues the sliced generation in the back texture with as many slabs as the budget allows.
+    // Returns true when the back texture is complete, in BC4 once its last range was also read back and encoded.
+    bool generateSlabs() {
+        int remaining = numSlabs() - m_nextSlab;
+        if (remaining > 0) {
+            int count = m_msPerSlab > 0.0f ? static_cast<int>(m_sliceBudgetMs / m_msPerSlab) : 1;
+            count = glm::clamp(count, 1, remaining);
+
+            dispatch(m_backTexture, m_generatedParams, m_sliceTime, m_nextSlab, count);
+            m_nextSlab += count;
+        }
+
+        if (m_nextSlab < numSlabs() || readbackPending(m_backTexture)) return false;
+
+        m_sliceActive = false;
+        m_numGenerations++;
+        return true;
+    }
+
+    // Generates the slabs [firstSlab, firstSlab + numSlabs) of the texture
+    void dispatch(GLuint texture, const GenerationParams &params, float time, int firstSlab, int slabCount) {
+        glUseProgram(shaderID);
+
+        setUniform(shaderID, "u_targetSize", params.domainSize);
+        setUniform(shaderID, "u_targetOffset", params.domainCenter);
+        setUniform(shaderID, "u_time", time);
+        setUniform(shaderID, "u_offset", glm::ivec3(0, 0, firstSlab * SLAB_DEPTH));
+        setUniform(shaderID, "u_useNoiseTextures", params.useNoiseTextures);
+
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_3D, m_noise.m_baseNoise);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_3D, m_noise.m_detailNoise);
+
+        bool timed = !m_timerPending; // Only one measure in flight at a time
+        if (timed) glQueryCounter(m_timerQueries[0], GL_TIMESTAMP);
+
+        bool compressed = m_allocatedFormat == VOLUME_BC4;
+        GLenum imageFormat = volumeFormatInfo(m_allocatedFormat).imageFormat;
+
+        glBindImageTexture(0, compressed ? m_stagingTexture : texture, 0, GL_TRUE, 0, GL_WRITE_ONLY, imageFormat);
+        glDispatchCompute(dimXZ/8, dimY/8, slabCount * SLAB_DEPTH / 8);
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT
+                        | GL_FRAMEBUFFER_BARRIER_BIT);
+        glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, imageFormat);
+
+        if (timed) {
+            glQueryCounter(m_timerQueries[1], GL_TIMESTAMP);
+            m_timerPending = true;
+            m_timedSlabs = slabCount;
+        }
 
         glUseProgram(0);
+
+        bool completes = firstSlab + slabCount == numSlabs(); // The last slabs complete the volume
+        if (compressed) startReadback(texture, firstSlab * SLAB_DEPTH, slabCount * SLAB_DEPTH, completes);
+        else if (completes) volumeCompleted(texture);
+    }
+
+    // Copies the Z-slices [firstZ, firstZ + numZ) of the staging texture to a pixel pack buffer, without waiting for the dispatch
+    void startReadback(GLuint texture, int firstZ, int numZ, bool completes) {
+        size_t sliceBytes = static_cast<size_t>(dimXZ) * dimY * sizeof(float);
+
+        Readback readback {};
+        if (m_freeBuffers.empty()) {
+            glGenBuffers(1, &readback.buffer);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+            glBufferData(GL_PIXEL_PACK_BUFFER, sliceBytes * dimXZ, nullptr, GL_STREAM_READ);
+        } else {
+            readback.buffer = m_freeBuffers.back();
+            m_freeBuffers.pop_back();
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+        }
+
+        // glGetTexImage cannot read a sub-range, a 3D texture is read one layer at a time through a framebuffer
+        if (!m_readFramebuffer) glGenFramebuffers(1, &m_readFramebuffer);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, m_readFramebuffer);
+        glReadBuffer(GL_COLOR_ATTACHMENT0);
+        glPixelStorei(GL_PACK_ALIGNMENT, 4);
+        for (int z = 0; z < numZ; z++) {
+            glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, m_stagingTexture, 0, firstZ + z);
+            glReadPixels(0, 0, dimXZ, dimY, GL_RED, GL_FLOAT, reinterpret_cast<void *>(z * sliceBytes));
+        }
+        glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, 0, 0, 0);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+        readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        readback.texture = texture;
+        readback.firstZ = firstZ;
+        readback.numZ = numZ;
+        readback.completes = completes;
+        m_readbacks.push_back(readback);
+    }
+
+    // Encodes and uploads the readbacks whose copy is done, in order. With wait, blocks until all of them are.
+    void finishReadbacks(bool wait) {
+        size_t done = 0;
+        for (; done < m_readbacks.size(); done++) {
+            Readback &readback = m_readbacks[done];
+
+            GLenum status = glClientWaitSync(readback.fence, 0, 0);
+            while (wait && status == GL_TIMEOUT_EXPIRED) status = glClientWaitSync(readback.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ull);
+            if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) break;
+
+            double start = glfwGetTime();
+
+            size_t sliceVoxels = static_cast<size_t>(dimXZ) * dimY;
+            size_t bytes = sliceVoxels * readback.numZ * sizeof(float);
+            std::vector<float> &levelZero = m_levelZero[volumeIndex(readback.texture)]; // Kept for the mips
+            levelZero.resize(sliceVoxels * dimXZ);
+
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+            const float *slices = static_cast<const float *>(glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, bytes, GL_MAP_READ_BIT));
+            if (slices) {
+                std::memcpy(levelZero.data() + sliceVoxels * readback.firstZ, slices, bytes);
+                glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+
+                Bc4Encoder::encode(levelZero.data(), dimXZ, dimY, readback.firstZ, readback.numZ, m_blocks);
+
+                glBindTexture(GL_TEXTURE_3D, readback.texture);
+                glCompressedTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, readback.firstZ, dimXZ, dimY, readback.numZ, GL_COMPRESSED_RED_RGTC1,
+                                          static_cast<GLsizei>(m_blocks.size()), m_blocks.data());
+                glBindTexture(GL_TEXTURE_3D, 0);
+            } else {
+                std::cerr << "ERROR: Cannot map the BC4 readback buffer" << std::endl;
+            }
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+            glDeleteSync(readback.fence);
+            m_freeBuffers.push_back(readback.buffer);
+
+            if (readback.completes) volumeCompleted(readback.texture, levelZero.data());
+
+            m_lastEncodeMs = static_cast<float>((glfwGetTime() - start) * 1000.0); // The mips included
+            m_frameEncodeMs += m_lastEncodeMs;
+        }
+        m_readbacks.erase(m_readbacks.begin(), m_readbacks.begin() + done);
+    }
+
+    bool readbackPending(GLuint texture) const {
+        for (const Readback &readback : m_readbacks) {
+            if (readback.texture == texture) return true;
+        }
+        return false;
+    }
+
+    // Drops the readbacks in flight, for volumes about to be deleted
+    void releaseReadbacks() {
+        for (const Readback &readback : m_readbacks) {
+            glDeleteSync(readback.fence);
+            m_freeBuffers.push_back(readback.buffer);
+        }
+        m_readbacks.clear();
+
+        if (!m_freeBuffers.empty()) glDeleteBuffers(static_cast<GLsizei>(m_freeBuffers.size()), m_freeBuffers.data());
+        m_freeBuffers.clear();
+
+        if (m_readFramebuffer) glDeleteFramebuffers(1, &m_readFramebuffer);
+        m_readFramebuffer = 0;
+    }
+
+    // Non-blocking read of the last timed dispatch
+    void readTimer() {
+        if (!m_timerPending) return;
+
+        GLint available = 0;
+        glGetQueryObjectiv(m_timerQueries[1], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) return;
+
+        GLuint64 start = 0, end = 0;
+        glGetQueryObjectui64v(m_timerQueries[0], GL_QUERY_RESULT, &start);
+        glGetQueryObjectui64v(m_timerQueries[1], GL_QUERY_RESULT, &end);
+
+        m_lastGenerationMs = static_cast<float>(end - start) * 1e-6f;
+        m_timerPending = false;
+
+        float msPerSlab = m_lastGenerationMs / m_timedSlabs;
+        m_msPerSlab = m_msPerSlab > 0.0f ? glm::mix(m_msPerSlab, msPerSlab, 0.2f) : msPerSlab;
     }
 };
 
-#endif // voxeltexture.hpp
\ No newline at end of file
+#endif // voxeltexture.hpp